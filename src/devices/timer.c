@@ -20,14 +20,58 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
-/* Lists for the threads awaiting a semaphore wakeup call */
-static struct list sleeping_threads;
+/* If true, the idle thread stops the periodic timer interrupt.
+   Controlled by kernel command-line option "-tickless". */
+bool timer_tickless;
+
+/* PIT cycles in one timer tick. */
+#define PIT_TICK_COUNT ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Longest one-shot interval, in ticks, that fits in the PIT's
+   16-bit counter.  About 5 ticks at 100 Hz. */
+#define ONE_SHOT_MAX_TICKS (UINT16_MAX / PIT_TICK_COUNT)
+
+/* Number of ticks the PIT is counting down in one-shot mode, or
+   0 if it is in its normal periodic mode. */
+static int one_shot_ticks;
+
+/* Threads sleeping in timer_sleep(), kept in a hierarchical
+   timing wheel keyed on their wakeup_ticks.
+
+   Level L has TIMER_WHEEL_SLOTS slots, one for each value of
+   "digit" L of a tick count, that is, bits 8*L through 8*L+7.
+   A sleeper is filed at the highest level whose digit of
+   wakeup_ticks differs from that of the current tick count, in
+   the slot for its own digit at that level.  When the tick
+   count's digits below level L all roll over to zero, the
+   current slot of level L is "cascaded" by refiling each of its
+   sleepers at a lower level, so that every sleeper reaches level
+   0 exactly on its wakeup tick.  Wakeups 2**32 or more ticks
+   away wait in timer_wheel_far until the low 32 bits of the tick
+   count roll over.
+
+   Insertion and cancellation are O(1), and each timer interrupt
+   touches only the current slot of each level that rolls over.
+   A sleeper is cascaded at most TIMER_WHEEL_LEVELS - 1 times. */
+#define TIMER_WHEEL_BITS 8
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+static struct list timer_wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+static struct list timer_wheel_far;
+
+/* Most CPU cycles spent in a single timer interrupt. */
+static uint64_t max_interrupt_cycles;
 
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
 static intr_handler_func timer_interrupt;
+static void timer_wheel_insert (struct thread *);
+static bool timer_wheel_expire (void);
+static int timer_wheel_idle_ticks (int max);
+static int64_t timer_one_shot_skipped (void);
+static void timer_resume_periodic (int64_t skipped);
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
@@ -39,11 +83,15 @@ static void real_time_delay (int64_t num, int32_t denom);
 void
 timer_init (void) 
 {
+  int level, slot;
+
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 
-  /* Initialize the necessary sleeping_threads list */
-  list_init(&sleeping_threads);
+  for (level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    for (slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+      list_init (&timer_wheel[level][slot]);
+  list_init (&timer_wheel_far);
 }
 
 /* Calibrates loops_per_tick, used to implement brief delays. */
@@ -91,33 +139,60 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
+/* Returns the current value of the CPU's time-stamp counter,
+   for measuring intervals shorter than a timer tick. */
+uint64_t
+timer_cycles (void) 
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
    be turned on. */
 void
 timer_sleep (int64_t ticks) 
 {
   int64_t start = timer_ticks ();
+  struct thread *curr_t = thread_current ();
+  enum intr_level old_level;
 
   ASSERT (intr_get_level () == INTR_ON);
 
-  struct thread *curr_t = thread_current();
+  old_level = intr_disable ();
 
-  /* Calculate absolute wakeup time and insert into thread information */
+  /* Calculate absolute wakeup time.  It may already have passed
+     if a tick arrived since we read START. */
   curr_t->wakeup_ticks = start + ticks; 
+  if (curr_t->wakeup_ticks > timer_ticks ())
+    {
+      timer_wheel_insert (curr_t);
+      thread_block ();
+    }
 
-  /* Initialize semaphore */
-  sema_init( &curr_t->sleeping_sema, 0 );
+  intr_set_level (old_level);
+}
+
+/* If T is sleeping in timer_sleep(), wakes it up early and
+   returns true.  Otherwise returns false.
 
-  /* Add to sleeping_threads */
-  list_insert_ordered (&sleeping_threads, &(curr_t->time_elem), &compare_wakeup_ticks, NULL);
+   This function may be called from an interrupt handler. */
+bool
+timer_wake (struct thread *t) 
+{
+  enum intr_level old_level = intr_disable ();
+  bool sleeping = t->wakeup_ticks > ticks && t->status == THREAD_BLOCKED;
 
-  /* Call sema down to put thread to sleep */
-  sema_down( &curr_t->sleeping_sema );
+  if (sleeping)
+    {
+      list_remove (&t->time_elem);
+      t->wakeup_ticks = ticks;
+      thread_unblock (t);
+    }
+  intr_set_level (old_level);
 
-  // TODO
-//  ASSERT (intr_get_level () == INTR_ON);
-//  while (timer_elapsed (start) < ticks) 
-//    thread_yield ();
+  return sleeping;
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -183,6 +258,65 @@ timer_ndelay (int64_t ns)
   real_time_delay (ns, 1000 * 1000 * 1000);
 }
 
+/* Called by the idle thread, with interrupts off, just before it
+   halts the CPU.  In tickless mode, if the next few ticks have no
+   sleeper to wake and no timing wheel cascade to run, replaces
+   the periodic timer interrupt by a single interrupt at the first
+   tick that does.  The PIT's 16-bit counter limits this to
+   ONE_SHOT_MAX_TICKS ticks at a time. */
+void
+timer_idle_enter (void) 
+{
+  int idle_ticks;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!timer_tickless || one_shot_ticks != 0)
+    return;
+
+  idle_ticks = timer_wheel_idle_ticks (ONE_SHOT_MAX_TICKS);
+  if (idle_ticks > 1)
+    {
+      one_shot_ticks = idle_ticks;
+      pit_start_one_shot (0, idle_ticks * PIT_TICK_COUNT);
+    }
+}
+
+/* Called by the scheduler, with interrupts off, when the idle
+   thread gives up the CPU.  If the idle thread was woken by some
+   interrupt other than its one-shot timer, credits the whole
+   ticks that passed in the meantime and restores the periodic
+   timer.  Less than a tick of time may be lost. */
+void
+timer_idle_exit (void) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (one_shot_ticks != 0)
+    timer_resume_periodic (timer_one_shot_skipped ());
+}
+
+/* Returns the largest number of CPU cycles spent in a single
+   timer interrupt since boot or the last call to
+   timer_reset_max_cycles(). */
+uint64_t
+timer_max_cycles (void) 
+{
+  enum intr_level old_level = intr_disable ();
+  uint64_t cycles = max_interrupt_cycles;
+  intr_set_level (old_level);
+  return cycles;
+}
+
+/* Resets the count returned by timer_max_cycles(). */
+void
+timer_reset_max_cycles (void) 
+{
+  enum intr_level old_level = intr_disable ();
+  max_interrupt_cycles = 0;
+  intr_set_level (old_level);
+}
+
 /* Prints timer statistics. */
 void
 timer_print_stats (void) 
@@ -194,29 +328,172 @@ timer_print_stats (void)
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
-//printf("timer_interrupt.\n"); //TODO
+  uint64_t start = timer_cycles ();
+  uint64_t cycles;
+
+  /* A one-shot interrupt stands for the ticks it skipped.  This
+     may also be a periodic tick latched just before the one-shot
+     was armed, so count the ticks that actually passed. */
+  if (one_shot_ticks != 0)
+    timer_resume_periodic (timer_one_shot_skipped ());
+
   ticks++;
 
-  /* If Timer elapsed of the first thread matches the number of timer ticks that the thread would sleep for, then wake it.*/
-  if(!list_empty(&sleeping_threads))
+  /* Wake up the threads whose wakeup_ticks is now, and yield on
+     return if one of them outranks the running thread. */
+  if (timer_wheel_expire ())
+    priority_check_running_vs_ready ();
+
+  thread_tick ();
+
+  cycles = timer_cycles () - start;
+  if (cycles > max_interrupt_cycles)
+    max_interrupt_cycles = cycles;
+}
+
+/* Returns digit LEVEL of tick count T, that is, its index into
+   that level of the timing wheel. */
+static inline unsigned
+timer_wheel_digit (uint64_t t, int level) 
+{
+  return (t >> (level * TIMER_WHEEL_BITS)) & (TIMER_WHEEL_SLOTS - 1);
+}
+
+/* Files sleeping thread T in the timing wheel according to its
+   wakeup_ticks, which must not be in the past.  A thread due on
+   the current tick lands in the current level-0 slot, which is
+   only possible while cascading, just before that slot expires.
+   Interrupts must be off. */
+static void
+timer_wheel_insert (struct thread *t) 
+{
+  uint64_t diff = (uint64_t) (t->wakeup_ticks ^ ticks);
+  int level;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->wakeup_ticks >= ticks);
+
+  if (diff >> (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS) != 0)
     {
-    struct thread *first_sleeping_thread = list_entry( list_front(&sleeping_threads), struct thread, time_elem);
+      list_push_back (&timer_wheel_far, &t->time_elem);
+      return;
+    }
 
-    /* Test all threads that have the same wakeup_ticks */
-    while( ticks >= first_sleeping_thread->wakeup_ticks )
-      {
-      sema_up( &first_sleeping_thread->sleeping_sema );
-      list_pop_front( &sleeping_threads );
+  for (level = TIMER_WHEEL_LEVELS - 1; level > 0; level--)
+    if (timer_wheel_digit (diff, level) != 0)
+      break;
+  list_push_back (&timer_wheel[level][timer_wheel_digit (t->wakeup_ticks,
+                                                         level)],
+                  &t->time_elem);
+}
+
+/* Refiles every thread in LIST in the timing wheel relative to
+   the current tick count. */
+static void
+timer_wheel_cascade (struct list *list) 
+{
+  while (!list_empty (list))
+    timer_wheel_insert (list_entry (list_pop_front (list),
+                                    struct thread, time_elem));
+}
 
-      /* break out if no more threads in list */
-      if( list_empty(&sleeping_threads) )
+/* Returns the number of ticks, between 1 and MAX, until the next
+   tick on which the timing wheel has work to do: a sleeper to
+   wake or a cascade to run.  Interrupts must be off. */
+static int
+timer_wheel_idle_ticks (int max) 
+{
+  int i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (i = 1; i < max; i++)
+    {
+      int64_t t = ticks + i;
+      if (timer_wheel_digit (t, 0) == 0
+          || !list_empty (&timer_wheel[0][timer_wheel_digit (t, 0)]))
         break;
-      else
-        first_sleeping_thread = list_entry( list_front(&sleeping_threads), struct thread, time_elem);
-      }
     }
+  return i;
+}
+
+/* Returns the number of whole ticks that have passed since the
+   PIT was put in one-shot mode, not counting the tick that its
+   interrupt delivers.  If the count has wrapped past zero, the
+   one-shot interval is over and its interrupt is due or being
+   handled, and it delivers the last tick itself.  Interrupts
+   must be off. */
+static int64_t
+timer_one_shot_skipped (void) 
+{
+  uint16_t count;
+  int64_t elapsed;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (one_shot_ticks != 0);
+
+  count = pit_read_count (0);
+  if (count > one_shot_ticks * PIT_TICK_COUNT)
+    return one_shot_ticks - 1;
+  elapsed = (one_shot_ticks * PIT_TICK_COUNT - count) / PIT_TICK_COUNT;
+  return elapsed < one_shot_ticks - 1 ? elapsed : one_shot_ticks - 1;
+}
+
+/* Returns the PIT to periodic mode after a one-shot interval and
+   advances the tick count by the SKIPPED ticks that passed
+   without an interrupt.  Interrupts must be off. */
+static void
+timer_resume_periodic (int64_t skipped) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  one_shot_ticks = 0;
+  pit_configure_channel (0, 2, TIMER_FREQ);
+  if (skipped > 0)
+    {
+      ticks += skipped;
+      thread_skip_ticks (skipped);
+    }
+}
 
-  thread_tick ();
+/* Returns true if the digits of the current tick count below
+   LEVEL are all zero, that is, if level LEVEL just advanced. */
+static inline bool
+timer_wheel_rolled_over (int level) 
+{
+  return ((uint64_t) ticks & ((1ull << (level * TIMER_WHEEL_BITS)) - 1)) == 0;
+}
+
+/* Advances the timing wheel to the current tick count and wakes
+   up every thread whose wakeup_ticks it is.  Returns true if any
+   thread was woken.  Called from the timer interrupt. */
+static bool
+timer_wheel_expire (void) 
+{
+  struct list *slot;
+  bool woke = false;
+  int level;
+
+  /* Cascade from the top down, so that sleepers moved out of a
+     higher level can be cascaded again by a lower one on the
+     same tick. */
+  if (timer_wheel_rolled_over (TIMER_WHEEL_LEVELS))
+    timer_wheel_cascade (&timer_wheel_far);
+  for (level = TIMER_WHEEL_LEVELS - 1; level > 0; level--)
+    if (timer_wheel_rolled_over (level))
+      timer_wheel_cascade (&timer_wheel[level][timer_wheel_digit (ticks,
+                                                                  level)]);
+
+  slot = &timer_wheel[0][timer_wheel_digit (ticks, 0)];
+  while (!list_empty (slot))
+    {
+      struct thread *t = list_entry (list_pop_front (slot),
+                                     struct thread, time_elem);
+      ASSERT (t->wakeup_ticks == ticks);
+      thread_unblock (t);
+      woke = true;
+    }
+  return woke;
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -2,11 +2,18 @@
 #define DEVICES_TIMER_H
 
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
+struct thread;
+
 /* Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
+/* If true, the idle thread stops the periodic timer interrupt.
+   Controlled by kernel command-line option "-tickless". */
+extern bool timer_tickless;
+
 void timer_init (void);
 void timer_calibrate (void);
 
@@ -18,12 +25,22 @@ void timer_sleep (int64_t ticks);
 void timer_msleep (int64_t milliseconds);
 void timer_usleep (int64_t microseconds);
 void timer_nsleep (int64_t nanoseconds);
+bool timer_wake (struct thread *);
+
+/* Tickless idle. */
+void timer_idle_enter (void);
+void timer_idle_exit (void);
 
 /* Busy waits. */
 void timer_mdelay (int64_t milliseconds);
 void timer_udelay (int64_t microseconds);
 void timer_ndelay (int64_t nanoseconds);
 
+/* Cycle counting. */
+uint64_t timer_cycles (void);
+uint64_t timer_max_cycles (void);
+void timer_reset_max_cycles (void);
+
 void timer_print_stats (void);
 
 #endif /* devices/timer.h */
@@ -6,6 +6,7 @@
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
@@ -53,15 +54,46 @@ byte_to_sector (const struct inode *inode, off_t pos)
     return -1;
 }
 
+/* Most full sectors that inode_read_at() and inode_write_at()
+   transfer with a single request. */
+#define MAX_RUN 32
+
+/* Returns the number of full sectors, at most MAX_RUN, starting
+   at OFFSET within INODE, which must be a multiple of
+   BLOCK_SECTOR_SIZE, that lie within both INODE and the first
+   SIZE bytes from OFFSET and that are contiguous on disk. */
+static size_t
+full_sector_run (const struct inode *inode, off_t offset, off_t size)
+{
+  block_sector_t start = byte_to_sector (inode, offset);
+  size_t cnt;
+
+  ASSERT (offset % BLOCK_SECTOR_SIZE == 0);
+
+  for (cnt = 1; cnt < MAX_RUN; cnt++)
+    {
+      off_t end = (off_t) (cnt + 1) * BLOCK_SECTOR_SIZE;
+      if (end > size || offset + end > inode->data.length
+          || byte_to_sector (inode, offset + end - BLOCK_SECTOR_SIZE)
+             != start + cnt)
+        break;
+    }
+  return cnt;
+}
+
 /* List of open inodes, so that opening a single inode twice
    returns the same `struct inode'. */
 static struct list open_inodes;
 
+/* Cache of in-memory inodes. */
+static struct kmem_cache inode_cache;
+
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
   list_init (&open_inodes);
+  kmem_cache_init (&inode_cache, "inode", sizeof (struct inode), NULL);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -127,7 +159,7 @@ inode_open (block_sector_t sector)
     }
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = kmem_cache_alloc (&inode_cache);
   if (inode == NULL)
     return NULL;
 
@@ -181,7 +213,7 @@ inode_close (struct inode *inode)
                             bytes_to_sectors (inode->data.length)); 
         }
 
-      free (inode); 
+      kmem_cache_free (&inode_cache, inode); 
     }
 }
 
@@ -222,8 +254,16 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 
       if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
         {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
+          /* Read full sectors directly into caller's buffer, as
+             many at once as are contiguous on disk. */
+          void *buffers[MAX_RUN];
+          size_t cnt = full_sector_run (inode, offset, size);
+          size_t i;
+
+          for (i = 0; i < cnt; i++)
+            buffers[i] = buffer + bytes_read + i * BLOCK_SECTOR_SIZE;
+          block_read_multiple (fs_device, sector_idx, buffers, cnt);
+          chunk_size = cnt * BLOCK_SECTOR_SIZE;
         }
       else 
         {
@@ -249,6 +289,40 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   return bytes_read;
 }
 
+/* Reads CNT whole sectors from INODE, starting at OFFSET, which
+   must be a multiple of BLOCK_SECTOR_SIZE, into BUFFERS[0]
+   through BUFFERS[CNT - 1], each of which must have room for
+   BLOCK_SECTOR_SIZE bytes.  Runs of sectors that are contiguous
+   on disk are read with a single request.  Bytes past the end
+   of file in the last sector are unspecified.  Returns true if
+   successful, false if a sector would start at or past end of
+   file, in which case nothing is read. */
+bool
+inode_read_sectors (struct inode *inode, off_t offset,
+                    void *const buffers[], size_t cnt)
+{
+  size_t i, run;
+
+  ASSERT (offset % BLOCK_SECTOR_SIZE == 0);
+
+  if (cnt > 0
+      && offset + (off_t) (cnt - 1) * BLOCK_SECTOR_SIZE
+         >= inode_length (inode))
+    return false;
+
+  for (i = 0; i < cnt; i += run)
+    {
+      block_sector_t start = byte_to_sector (inode, offset
+                                             + i * BLOCK_SECTOR_SIZE);
+      for (run = 1; i + run < cnt; run++)
+        if (byte_to_sector (inode, offset + (i + run) * BLOCK_SECTOR_SIZE)
+            != start + run)
+          break;
+      block_read_multiple (fs_device, start, buffers + i, run);
+    }
+  return true;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
    less than SIZE if end of file is reached or an error occurs.
@@ -283,8 +357,17 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 
       if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          /* Write full sectors directly to disk, as many at once
+             as are contiguous on disk. */
+          void *buffers[MAX_RUN];
+          size_t cnt = full_sector_run (inode, offset, size);
+          size_t i;
+
+          for (i = 0; i < cnt; i++)
+            buffers[i] = (void *) (buffer + bytes_written
+                                   + i * BLOCK_SECTOR_SIZE);
+          block_write_multiple (fs_device, sector_idx, buffers, cnt);
+          chunk_size = cnt * BLOCK_SECTOR_SIZE;
         }
       else 
         {
@@ -0,0 +1,87 @@
+/* Puts 5,000 threads to sleep at once for random durations and
+   verifies that each one sleeps at least as long as it asked to.
+   Reports the worst-case number of CPU cycles spent in a single
+   timer interrupt while they sleep, which should stay flat no
+   matter how many threads are sleeping. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <random.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define THREAD_CNT 5000         /* Number of sleeping threads. */
+#define MAX_DURATION 500        /* Longest sleep, in ticks. */
+
+/* Information about an individual thread in the test. */
+struct stress_thread 
+  {
+    int duration;               /* Number of ticks to sleep. */
+    int64_t slept;              /* Number of ticks actually slept. */
+    struct semaphore *done;     /* Upped when the thread wakes. */
+  };
+
+static thread_func sleeper;
+
+void
+test_alarm_stress (void) 
+{
+  struct stress_thread *threads;
+  struct semaphore done;
+  int early = 0;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  threads = malloc (sizeof *threads * THREAD_CNT);
+  if (threads == NULL)
+    PANIC ("couldn't allocate memory for test");
+  sema_init (&done, 0);
+  random_init (0);
+
+  msg ("Creating %d threads to sleep up to %d ticks each.",
+       THREAD_CNT, MAX_DURATION);
+  timer_reset_max_cycles ();
+  for (i = 0; i < THREAD_CNT; i++) 
+    {
+      struct stress_thread *t = &threads[i];
+      char name[16];
+
+      t->duration = random_ulong () % MAX_DURATION + 1;
+      t->done = &done;
+      snprintf (name, sizeof name, "sleeper %d", i);
+      if (thread_create (name, PRI_DEFAULT, sleeper, t) == TID_ERROR)
+        fail ("couldn't create thread %d", i);
+    }
+
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&done);
+  msg ("All %d threads woke up.", THREAD_CNT);
+
+  for (i = 0; i < THREAD_CNT; i++)
+    if (threads[i].slept < threads[i].duration)
+      early++;
+  if (early > 0)
+    fail ("%d threads woke up early", early);
+
+  msg ("worst-case timer interrupt: %"PRIu64" cycles", timer_max_cycles ());
+  free (threads);
+  pass ();
+}
+
+/* Sleeper thread. */
+static void
+sleeper (void *t_) 
+{
+  struct stress_thread *t = t_;
+  int64_t start = timer_ticks ();
+
+  timer_sleep (t->duration);
+  t->slept = timer_elapsed (start);
+  sema_up (t->done);
+}
@@ -0,0 +1,108 @@
+/* Times lock_acquire() and lock_release() through an 8-deep
+   chain of nested priority donations.
+
+   The main thread sets its priority to PRI_MIN, acquires lock 0,
+   and creates threads 1..8 with priorities PRI_MIN + 1..8.
+   Thread i acquires lock i (unless i == 8) and then blocks on
+   lock i - 1, so that thread 8's donation passes through threads
+   7..1 down to the main thread.  We time thread 8's
+   lock_acquire() up to the point where the main thread runs
+   again, and the main thread's release of lock 0 until the whole
+   chain has unwound and exited.  Both times include the context
+   switches involved.  The test repeats this ROUNDS times and
+   reports the averages. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define NESTING_DEPTH 8
+#define ROUNDS 100
+
+struct donor
+  {
+    struct lock *first;         /* Lock to hold, or NULL. */
+    struct lock *second;        /* Lock to block on. */
+    uint64_t *start;            /* Cycle count before blocking. */
+  };
+
+static thread_func donor_thread_func;
+
+void
+test_priority_donate_bench (void) 
+{
+  struct lock locks[NESTING_DEPTH];
+  struct donor donors[NESTING_DEPTH + 1];
+  uint64_t acquire_cycles = 0;
+  uint64_t release_cycles = 0;
+  uint64_t start;
+  int round, i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  thread_set_priority (PRI_MIN);
+
+  for (i = 0; i < NESTING_DEPTH; i++)
+    lock_init (&locks[i]);
+
+  for (i = 1; i <= NESTING_DEPTH; i++) 
+    {
+      donors[i].first = i < NESTING_DEPTH ? &locks[i] : NULL;
+      donors[i].second = &locks[i - 1];
+      donors[i].start = &start;
+    }
+
+  msg ("Timing %d rounds of %d-deep nested donation.",
+       ROUNDS, NESTING_DEPTH);
+  for (round = 0; round < ROUNDS; round++) 
+    {
+      uint64_t end;
+
+      lock_acquire (&locks[0]);
+      for (i = 1; i <= NESTING_DEPTH; i++)
+        {
+          char name[16];
+          snprintf (name, sizeof name, "donor %d", i);
+          thread_create (name, PRI_MIN + i, donor_thread_func, &donors[i]);
+        }
+      end = timer_cycles ();
+      acquire_cycles += end - start;
+      if (thread_get_priority () != PRI_MIN + NESTING_DEPTH)
+        fail ("main thread has priority %d, expected %d",
+              thread_get_priority (), PRI_MIN + NESTING_DEPTH);
+
+      start = timer_cycles ();
+      lock_release (&locks[0]);
+      release_cycles += timer_cycles () - start;
+      if (thread_get_priority () != PRI_MIN)
+        fail ("main thread has priority %d after release, expected %d",
+              thread_get_priority (), PRI_MIN);
+    }
+
+  msg ("lock_acquire with donation: %"PRIu64" cycles on average",
+       acquire_cycles / ROUNDS);
+  msg ("lock_release and unwind: %"PRIu64" cycles on average",
+       release_cycles / ROUNDS);
+  pass ();
+}
+
+static void
+donor_thread_func (void *donor_) 
+{
+  struct donor *donor = donor_;
+
+  if (donor->first != NULL)
+    lock_acquire (donor->first);
+
+  *donor->start = timer_cycles ();
+  lock_acquire (donor->second);
+  lock_release (donor->second);
+
+  if (donor->first != NULL)
+    lock_release (donor->first);
+}
@@ -0,0 +1,81 @@
+/* Three threads acquire a reader-writer lock in shared mode and
+   hold it at the same time.  Then a higher-priority writer
+   blocks on the lock, donating its priority to all three
+   readers.  As the readers release the lock one by one, each
+   should report the donated priority, and the writer should get
+   the lock as soon as the last reader lets go. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define READER_CNT 3
+
+struct rwlock_test
+  {
+    struct rwlock rwlock;       /* Lock under test. */
+    struct semaphore go;        /* Lets one reader release. */
+    int reader_cnt;             /* Readers currently holding rwlock. */
+  };
+
+static thread_func reader_thread_func;
+static thread_func writer_thread_func;
+
+void
+test_rwlock_readers (void) 
+{
+  struct rwlock_test test;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  rwlock_init (&test.rwlock);
+  sema_init (&test.go, 0);
+  test.reader_cnt = 0;
+
+  for (i = 0; i < READER_CNT; i++) 
+    {
+      char name[16];
+      snprintf (name, sizeof name, "reader %d", i);
+      thread_create (name, PRI_DEFAULT + 1, reader_thread_func, &test);
+    }
+  thread_create ("writer", PRI_DEFAULT + 2, writer_thread_func, &test);
+
+  msg ("Letting the readers release the lock.");
+  for (i = 0; i < READER_CNT; i++)
+    sema_up (&test.go);
+  msg ("Readers and writer must already have finished.");
+}
+
+static void
+reader_thread_func (void *test_) 
+{
+  struct rwlock_test *test = test_;
+
+  rwlock_acquire_read (&test->rwlock);
+  test->reader_cnt++;
+  msg ("%s: acquired shared lock, %d readers.",
+       thread_name (), test->reader_cnt);
+  sema_down (&test->go);
+  msg ("%s: releasing at priority %d.",
+       thread_name (), thread_get_priority ());
+  test->reader_cnt--;
+  rwlock_release_read (&test->rwlock);
+}
+
+static void
+writer_thread_func (void *test_) 
+{
+  struct rwlock_test *test = test_;
+
+  msg ("writer: waiting for exclusive lock.");
+  rwlock_acquire_write (&test->rwlock);
+  msg ("writer: acquired exclusive lock, %d readers.", test->reader_cnt);
+  rwlock_release_write (&test->rwlock);
+}
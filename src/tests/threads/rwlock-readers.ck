@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rwlock-readers) begin
+(rwlock-readers) reader 0: acquired shared lock, 1 readers.
+(rwlock-readers) reader 1: acquired shared lock, 2 readers.
+(rwlock-readers) reader 2: acquired shared lock, 3 readers.
+(rwlock-readers) writer: waiting for exclusive lock.
+(rwlock-readers) Letting the readers release the lock.
+(rwlock-readers) reader 0: releasing at priority 33.
+(rwlock-readers) reader 1: releasing at priority 33.
+(rwlock-readers) reader 2: releasing at priority 33.
+(rwlock-readers) writer: acquired exclusive lock, 0 readers.
+(rwlock-readers) Readers and writer must already have finished.
+(rwlock-readers) end
+EOF
+pass;
@@ -0,0 +1,86 @@
+/* Checks that a waiting writer is not starved by readers that
+   arrive after it.
+
+   Reader R1 acquires a reader-writer lock in shared mode.
+   Writer W then blocks acquiring it in exclusive mode, donating
+   its priority to R1.  Reader R2, at the same priority as W,
+   arrives next.  Although the lock is only held in shared mode,
+   R2 must wait behind W.  When R1 releases the lock, W should
+   get it before R2, so that W waits only for the reader that
+   held the lock when W arrived. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+struct rwlock_test
+  {
+    struct rwlock rwlock;       /* Lock under test. */
+    struct semaphore go;        /* Lets R1 release. */
+  };
+
+static thread_func r1_thread_func;
+static thread_func r2_thread_func;
+static thread_func w_thread_func;
+
+void
+test_rwlock_writer (void) 
+{
+  struct rwlock_test test;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  rwlock_init (&test.rwlock);
+  sema_init (&test.go, 0);
+
+  thread_create ("R1", PRI_DEFAULT + 1, r1_thread_func, &test);
+  thread_create ("W", PRI_DEFAULT + 2, w_thread_func, &test);
+  thread_create ("R2", PRI_DEFAULT + 2, r2_thread_func, &test);
+
+  msg ("Letting R1 release the lock.");
+  sema_up (&test.go);
+  msg ("R1, W, and R2 must already have finished, in that order.");
+}
+
+static void
+r1_thread_func (void *test_) 
+{
+  struct rwlock_test *test = test_;
+
+  rwlock_acquire_read (&test->rwlock);
+  msg ("R1: acquired shared lock.");
+  sema_down (&test->go);
+  msg ("R1: releasing at priority %d.", thread_get_priority ());
+  rwlock_release_read (&test->rwlock);
+  msg ("R1: done");
+}
+
+static void
+w_thread_func (void *test_) 
+{
+  struct rwlock_test *test = test_;
+
+  msg ("W: waiting for exclusive lock.");
+  rwlock_acquire_write (&test->rwlock);
+  msg ("W: acquired exclusive lock.");
+  rwlock_release_write (&test->rwlock);
+  msg ("W: done");
+}
+
+static void
+r2_thread_func (void *test_) 
+{
+  struct rwlock_test *test = test_;
+
+  msg ("R2: waiting for shared lock.");
+  rwlock_acquire_read (&test->rwlock);
+  msg ("R2: acquired shared lock.");
+  rwlock_release_read (&test->rwlock);
+  msg ("R2: done");
+}
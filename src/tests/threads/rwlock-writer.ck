@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rwlock-writer) begin
+(rwlock-writer) R1: acquired shared lock.
+(rwlock-writer) W: waiting for exclusive lock.
+(rwlock-writer) R2: waiting for shared lock.
+(rwlock-writer) Letting R1 release the lock.
+(rwlock-writer) R1: releasing at priority 33.
+(rwlock-writer) W: acquired exclusive lock.
+(rwlock-writer) W: done
+(rwlock-writer) R2: acquired shared lock.
+(rwlock-writer) R2: done
+(rwlock-writer) R1: done
+(rwlock-writer) R1, W, and R2 must already have finished, in that order.
+(rwlock-writer) end
+EOF
+pass;
@@ -0,0 +1,51 @@
+/* Measures the throughput of large reads: writes a 64 kB file,
+   then reads it back in one 64 kB read per pass, many times,
+   verifying the data each time.
+
+   User programs have no clock, so the test itself only checks
+   correctness.  Compare the timer ticks and the block device
+   read counts that the kernel prints at shutdown between kernel
+   builds to judge the cost of each pass. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BUF_SIZE 65536
+#define PASSES 32
+
+static char wbuf[BUF_SIZE];
+static char rbuf[BUF_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "bench";
+  size_t i;
+  int fd;
+  int pass;
+
+  for (i = 0; i < sizeof wbuf; i++)
+    wbuf[i] = i % 251;
+
+  CHECK (create (file_name, sizeof wbuf), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, wbuf, sizeof wbuf) == sizeof wbuf,
+         "write \"%s\"", file_name);
+
+  msg ("read \"%s\" %d times", file_name, PASSES);
+  for (pass = 0; pass < PASSES; pass++)
+    {
+      seek (fd, 0);
+      memset (rbuf, 0, sizeof rbuf);
+      if (read (fd, rbuf, sizeof rbuf) != sizeof rbuf)
+        fail ("read \"%s\" failed on pass %d", file_name, pass);
+      if (memcmp (rbuf, wbuf, sizeof rbuf))
+        fail ("read \"%s\" returned wrong data on pass %d",
+              file_name, pass);
+    }
+
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(read-bench) begin
+(read-bench) create "bench"
+(read-bench) open "bench"
+(read-bench) write "bench"
+(read-bench) read "bench" 32 times
+(read-bench) close "bench"
+(read-bench) end
+read-bench: exit(0)
+EOF
+pass;
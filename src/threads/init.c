@@ -37,6 +37,11 @@
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+#endif
 
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
@@ -57,8 +62,12 @@ static const char *swap_bdev_name;
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+/* -pse: Map kernel memory with 4 MB pages where possible? */
+static bool large_pages;
+
 static void bss_init (void);
 static void paging_init (void);
+static bool cpu_has_pse (void);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
@@ -119,6 +128,7 @@ main (void)
   thread_start ();
   serial_init_queue ();
   timer_calibrate ();
+  palloc_start_zeroing ();
 
 #ifdef FILESYS
   /* Initialize file system. */
@@ -127,6 +137,12 @@ main (void)
   filesys_init (format_filesys);
 #endif
 
+#ifdef VM
+  /* Initialize virtual memory. */
+  swap_init ();
+  frame_init ();
+#endif
+
   printf ("Boot complete.\n");
   
   /* Run actions specified on kernel command line. */
@@ -150,16 +166,43 @@ bss_init (void)
   memset (&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* CR4 bit that enables 4 MB pages. */
+#define CR4_PSE 0x00000010
+
+/* CPUID function 1 EDX bit that says 4 MB pages are supported. */
+#define CPUID_PSE 0x00000008
+
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   If the -pse option was given and the CPU supports it, each 4 MB
+   region of RAM that holds no kernel text is mapped by a single
+   large-page PDE, needing no page table and only one TLB entry.
+   The region holding the kernel text keeps 4 kB pages so that the
+   text can stay read-only, as does a partial region at the top
+   of RAM. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
   size_t page;
   extern char _start, _end_kernel_text;
+  bool pse = false;
+
+  if (large_pages)
+    {
+      if (cpu_has_pse ())
+        {
+          uint32_t cr4;
+          asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+          asm volatile ("movl %0, %%cr4" : : "r" (cr4 | CR4_PSE));
+          pse = true;
+        }
+      else
+        printf ("paging: CPU lacks 4 MB pages, using 4 kB pages\n");
+    }
 
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   pt = NULL;
@@ -171,6 +214,15 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      if (pse && pte_idx == 0
+          && init_ram_pages - page >= PTSPAN / PGSIZE
+          && !(vaddr < &_end_kernel_text && &_start < vaddr + PTSPAN))
+        {
+          pd[pde_idx] = pde_create_large (vaddr, true);
+          page += PTSPAN / PGSIZE - 1;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
@@ -188,6 +240,17 @@ paging_init (void)
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
 }
 
+/* Returns true if the CPU supports 4 MB pages, false
+   otherwise. */
+static bool
+cpu_has_pse (void)
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+
+  asm ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  return (edx & CPUID_PSE) != 0;
+}
+
 /* Breaks the kernel command line into words and returns them as
    an argv-like array. */
 static char **
@@ -256,9 +319,23 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-tickless"))
+        timer_tickless = true;
+      else if (!strcmp (name, "-buddy"))
+        palloc_buddy = true;
+      else if (!strcmp (name, "-prezero"))
+        palloc_prezero = true;
+      else if (!strcmp (name, "-rebalance"))
+        palloc_rebalance = true;
+      else if (!strcmp (name, "-pse"))
+        large_pages = true;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-sl"))
+        stack_page_limit = atoi (value);
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -292,6 +369,13 @@ run_task (char **argv)
   printf ("Execution of '%s' complete.\n", task);
 }
 
+/* Prints thread and scheduler statistics. */
+static void
+print_thread_stats (char **argv UNUSED)
+{
+  thread_print_stats ();
+}
+
 /* Executes all of the actions specified in ARGV[]
    up to the null pointer sentinel. */
 static void
@@ -309,6 +393,7 @@ run_actions (char **argv)
   static const struct action actions[] = 
     {
       {"run", 2, run_task},
+      {"thread-stats", 1, print_thread_stats},
 #ifdef FILESYS
       {"ls", 1, fsutil_ls},
       {"cat", 2, fsutil_cat},
@@ -357,6 +442,7 @@ usage (void)
 #else
           "  run TEST           Run TEST.\n"
 #endif
+          "  thread-stats       Print per-thread CPU time and dispatch latency.\n"
 #ifdef FILESYS
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
@@ -379,8 +465,16 @@ usage (void)
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -tickless          Stop the timer interrupt while idle.\n"
+          "  -buddy             Use the buddy page allocator.\n"
+          "  -prezero           Zero free pages in the background.\n"
+          "  -rebalance         Move pages between kernel and user pools.\n"
+          "  -pse               Map kernel memory with 4 MB pages.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -sl=COUNT          Limit user stacks to COUNT pages.\n"
 #endif
           );
   shutdown_power_off ();
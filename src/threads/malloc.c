@@ -7,6 +7,7 @@
 #include <string.h>
 #include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* A simple implementation of malloc().
@@ -28,6 +29,16 @@
    blocks, we remove all of the arena's blocks from the free list
    and give the arena back to the page allocator.
 
+   Each thread also keeps a "magazine" of free blocks for each
+   descriptor, a short stack of blocks that it has freed.
+   malloc() takes blocks from the running thread's magazine and
+   free() puts them back, without taking the descriptor's lock.
+   Only an empty magazine is refilled from, and a full one
+   flushed to, the descriptor's free list, MAG_BATCH blocks at a
+   time under a single lock acquisition.  Blocks in a magazine
+   count as in use as far as their arena is concerned.  A
+   thread's magazines are flushed when it exits.
+
    We can't handle blocks bigger than 2 kB using this scheme,
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
@@ -41,6 +52,7 @@ struct desc
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
     struct list free_list;      /* List of free blocks. */
     struct lock lock;           /* Lock. */
+    char name[16];              /* Lock name, for statistics. */
   };
 
 /* Magic number for detecting arena corruption. */
@@ -57,13 +69,26 @@ struct arena
 /* Free block. */
 struct block 
   {
-    struct list_elem free_elem; /* Free list element. */
+    union
+      {
+        struct list_elem free_elem;     /* Free list element. */
+        struct block *next;             /* Next block in magazine. */
+      };
   };
 
+/* Magazine sizing: a magazine holds at most MAG_MAX blocks, and
+   moves MAG_BATCH blocks at a time to or from the free list. */
+#define MAG_MAX 16
+#define MAG_BATCH 8
+
 /* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
+static struct desc descs[MALLOC_CLASS_CNT];     /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+static bool magazine_refill (struct desc *, struct malloc_magazine *);
+static void magazine_flush (struct desc *, struct malloc_magazine *,
+                            size_t cnt);
+static void desc_free (struct desc *, struct block *);
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
 
@@ -80,8 +105,37 @@ malloc_init (void)
       d->block_size = block_size;
       d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
       list_init (&d->free_list);
-      lock_init (&d->lock);
+      lock_init_adaptive (&d->lock);
+      snprintf (d->name, sizeof d->name, "malloc %zu", block_size);
+      lock_track (&d->lock, d->name);
     }
+  ASSERT (desc_cnt == MALLOC_CLASS_CNT);
+}
+
+/* Returns the blocks in the running thread's magazines to their
+   descriptors.  Called by thread_exit(). */
+void
+malloc_thread_exit (void) 
+{
+  struct malloc_magazine *mags = thread_current ()->malloc_mags;
+  size_t i;
+
+  for (i = 0; i < desc_cnt; i++)
+    if (mags[i].cnt > 0)
+      magazine_flush (&descs[i], &mags[i], mags[i].cnt);
+}
+
+/* Returns the number of times any descriptor's lock has been
+   acquired. */
+unsigned long long
+malloc_lock_cnt (void) 
+{
+  unsigned long long cnt = 0;
+  size_t i;
+
+  for (i = 0; i < desc_cnt; i++)
+    cnt += descs[i].lock.acquire_cnt;
+  return cnt;
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
@@ -90,6 +144,7 @@ void *
 malloc (size_t size) 
 {
   struct desc *d;
+  struct malloc_magazine *m;
   struct block *b;
   struct arena *a;
 
@@ -119,37 +174,14 @@ malloc (size_t size)
       return a + 1;
     }
 
-  lock_acquire (&d->lock);
-
-  /* If the free list is empty, create a new arena. */
-  if (list_empty (&d->free_list))
-    {
-      size_t i;
-
-      /* Allocate a page. */
-      a = palloc_get_page (0);
-      if (a == NULL) 
-        {
-          lock_release (&d->lock);
-          return NULL; 
-        }
-
-      /* Initialize arena and add its blocks to the free list. */
-      a->magic = ARENA_MAGIC;
-      a->desc = d;
-      a->free_cnt = d->blocks_per_arena;
-      for (i = 0; i < d->blocks_per_arena; i++) 
-        {
-          struct block *b = arena_to_block (a, i);
-          list_push_back (&d->free_list, &b->free_elem);
-        }
-    }
-
-  /* Get a block from free list and return it. */
-  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-  a = block_to_arena (b);
-  a->free_cnt--;
-  lock_release (&d->lock);
+  /* Take a block from the running thread's magazine, refilling
+     it from the free list if it is empty. */
+  m = &thread_current ()->malloc_mags[d - descs];
+  if (m->cnt == 0 && !magazine_refill (d, m))
+    return NULL;
+  b = m->top;
+  m->top = b->next;
+  m->cnt--;
   return b;
 }
 
@@ -227,32 +259,21 @@ free (void *p)
       if (d != NULL) 
         {
           /* It's a normal block.  We handle it here. */
+          struct malloc_magazine *m
+            = &thread_current ()->malloc_mags[d - descs];
 
 #ifndef NDEBUG
           /* Clear the block to help detect use-after-free bugs. */
           memset (b, 0xcc, d->block_size);
 #endif
   
-          lock_acquire (&d->lock);
-
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
-
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
-            {
-              size_t i;
-
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++) 
-                {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
-                }
-              palloc_free_page (a);
-            }
-
-          lock_release (&d->lock);
+          /* Put the block in the running thread's magazine,
+             first flushing part of the magazine if it is full. */
+          if (m->cnt >= MAG_MAX)
+            magazine_flush (d, m, MAG_BATCH);
+          b->next = m->top;
+          m->top = b;
+          m->cnt++;
         }
       else
         {
@@ -263,6 +284,99 @@ free (void *p)
     }
 }
 
+/* Moves up to MAG_BATCH blocks from D's free list into the
+   empty magazine M, first creating a new arena if the free list
+   is empty.  Returns true if successful, false if no memory is
+   available. */
+static bool
+magazine_refill (struct desc *d, struct malloc_magazine *m) 
+{
+  ASSERT (m->cnt == 0);
+
+  lock_acquire (&d->lock);
+
+  /* If the free list is empty, create a new arena. */
+  if (list_empty (&d->free_list))
+    {
+      struct arena *a;
+      size_t i;
+
+      /* Allocate a page. */
+      a = palloc_get_page (0);
+      if (a == NULL) 
+        {
+          lock_release (&d->lock);
+          return false; 
+        }
+
+      /* Initialize arena and add its blocks to the free list. */
+      a->magic = ARENA_MAGIC;
+      a->desc = d;
+      a->free_cnt = d->blocks_per_arena;
+      for (i = 0; i < d->blocks_per_arena; i++) 
+        {
+          struct block *b = arena_to_block (a, i);
+          list_push_back (&d->free_list, &b->free_elem);
+        }
+    }
+
+  /* Move blocks from the free list to the magazine. */
+  while (m->cnt < MAG_BATCH && !list_empty (&d->free_list))
+    {
+      struct block *b = list_entry (list_pop_front (&d->free_list),
+                                    struct block, free_elem);
+      block_to_arena (b)->free_cnt--;
+      b->next = m->top;
+      m->top = b;
+      m->cnt++;
+    }
+
+  lock_release (&d->lock);
+  return true;
+}
+
+/* Returns up to CNT blocks from magazine M to D's free list. */
+static void
+magazine_flush (struct desc *d, struct malloc_magazine *m, size_t cnt) 
+{
+  lock_acquire (&d->lock);
+  while (cnt-- > 0 && m->cnt > 0)
+    {
+      struct block *b = m->top;
+      m->top = b->next;
+      m->cnt--;
+      desc_free (d, b);
+    }
+  lock_release (&d->lock);
+}
+
+/* Adds block B to D's free list, freeing B's arena if it is
+   now entirely unused.  D's lock must be held. */
+static void
+desc_free (struct desc *d, struct block *b) 
+{
+  struct arena *a = block_to_arena (b);
+
+  ASSERT (lock_held_by_current_thread (&d->lock));
+
+  /* Add block to free list. */
+  list_push_front (&d->free_list, &b->free_elem);
+
+  /* If the arena is now entirely unused, free it. */
+  if (++a->free_cnt >= d->blocks_per_arena) 
+    {
+      size_t i;
+
+      ASSERT (a->free_cnt == d->blocks_per_arena);
+      for (i = 0; i < d->blocks_per_arena; i++) 
+        {
+          struct block *b = arena_to_block (a, i);
+          list_remove (&b->free_elem);
+        }
+      palloc_free_page (a);
+    }
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
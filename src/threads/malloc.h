@@ -4,7 +4,21 @@
 #include <debug.h>
 #include <stddef.h>
 
+/* Number of block sizes that malloc() manages in arenas, 16
+   through 1024 bytes. */
+#define MALLOC_CLASS_CNT 7
+
+/* A thread's private cache of free blocks of one size.  See the
+   comment at the top of malloc.c. */
+struct malloc_magazine 
+  {
+    void *top;                  /* Most recently freed block. */
+    unsigned cnt;               /* Number of blocks. */
+  };
+
 void malloc_init (void);
+void malloc_thread_exit (void);
+unsigned long long malloc_lock_cnt (void);
 void *malloc (size_t) __attribute__ ((malloc));
 void *calloc (size_t, size_t) __attribute__ ((malloc));
 void *realloc (void *, size_t);
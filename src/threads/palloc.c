@@ -2,13 +2,16 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -23,7 +26,71 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   By default, each pool finds free pages by a first-fit scan of
+   its bitmap.  With the -buddy kernel option, each pool instead
+   uses a binary buddy allocator, which keeps a free list of
+   blocks of each power-of-2 size, or "order", up to
+   2**(BUDDY_ORDERS - 1) pages.  A request is served from the
+   smallest nonempty order that fits, splitting the block as
+   necessary and returning any pages beyond the request to the
+   free lists.  A freed block is merged with its "buddy", the
+   other half of the next larger block, whenever the buddy is
+   free too.  Both take time logarithmic in the size of the
+   pool.  The bitmap is kept up to date either way.
+
+   The buddy allocator's free lists are linked through the free
+   pages themselves.  Because palloc_free_page() is called from
+   the scheduler to free the page of a dying thread, where
+   sleeping on a lock is not an option, they are protected by
+   disabling interrupts rather than by the pool's lock. */
+
+/* With the -prezero kernel option, a lowest-priority kernel
+   thread scrubs freed pages, so that PAL_ZERO requests for a
+   single page can usually skip zeroing it.  It takes the coldest
+   pages from each pool's hot page cache, zeroes them, and keeps
+   them on a list of zeroed pages.  It never takes pages from the
+   pool's allocator, so the pages on the list were already
+   allocated as far as the rest of the pool is concerned.  Each
+   one's first bytes hold its list element, which is cleared when
+   the page is handed out.  When a pool runs out of single free
+   pages, requests are served from its zeroed pages too, and when
+   it runs out of contiguous ones, the zeroed pages are returned
+   to the allocator.  The zeroing thread keeps up to ZERO_TARGET
+   pages on each list and is woken when a page is freed while a
+   list is short of that, or when one drops below ZERO_LOW. */
+#define ZERO_TARGET 64
+#define ZERO_LOW 32
+
+/* Single pages are allocated from and freed to a small cache of
+   recently freed, and thus likely cache-warm, pages in each
+   pool, which only requires disabling interrupts briefly.  An
+   empty cache is refilled, and a full one of HOT_MAX pages
+   flushed, HOT_BATCH pages at a time.  Pages in the cache are
+   allocated as far as the rest of the pool is concerned.
+   palloc_free_batch() returns many pages in one operation. */
+#define HOT_MAX 32
+#define HOT_BATCH 16
+
+/* With the -rebalance kernel option, the boundary between the
+   kernel and user pools moves at runtime.  The two pools share
+   one span of pages: the kernel pool is indexed upward from the
+   bottom of the span and the user pool downward from the top, so
+   that each allocates first-fit away from the boundary and their
+   metadata covers the whole span.  When a pool runs out of pages
+   it borrows the CHUNK_PAGES pages next to the boundary from the
+   other pool, provided that they are all free there and that the
+   lender is left with at least LEND_WATERMARK free pages.  The
+   kernel pool never shrinks below half of its initial size, and
+   the user pool never grows beyond the -ul limit. */
+#define CHUNK_ORDER 6
+#define CHUNK_PAGES ((size_t) 1 << CHUNK_ORDER)
+#define LEND_WATERMARK CHUNK_PAGES
+
+/* Number of buddy allocator orders: blocks of 1, 2, 4, ...,
+   2**(BUDDY_ORDERS - 1) pages. */
+#define BUDDY_ORDERS 11
 
 /* A memory pool. */
 struct pool
@@ -31,14 +98,91 @@ struct pool
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
     uint8_t *base;                      /* Base of pool. */
+    bool reversed;                      /* Indexed downward from base? */
+    size_t page_cnt;                    /* Number of pages owned. */
+    const char *name;                   /* Name, for statistics. */
+
+    /* Buddy allocator, used only if palloc_buddy is true. */
+    uint8_t *order_map;                 /* Per page: 1 + order of free
+                                           block starting there, or 0. */
+    struct list free_lists[BUDDY_ORDERS];  /* Free blocks of each order. */
+    size_t free_blocks[BUDDY_ORDERS];   /* Length of each free list. */
+
+    /* Hot page cache: recently freed single pages, most recent
+       first.  Protected by disabling interrupts. */
+    struct list hot;                    /* Cached pages. */
+    size_t hot_cnt;                     /* Number of cached pages. */
+
+    /* Pre-zeroed pages, used only if palloc_prezero is true.
+       Protected by disabling interrupts. */
+    struct list zeroed;                 /* Zeroed pages. */
+    size_t zeroed_cnt;                  /* Number of zeroed pages. */
+
+    /* Statistics. */
+    size_t used_cnt;                    /* Pages allocated, or cached. */
+    size_t used_peak;                   /* High-water mark of used_cnt. */
+    int chunks_borrowed;                /* Net chunks borrowed by rebalancing. */
+    unsigned long long zero_avoided;    /* PAL_ZERO from zeroed list. */
+    unsigned long long zero_filled;     /* PAL_ZERO zeroed on demand. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
-static void init_pool (struct pool *, void *base, size_t page_cnt,
-                       const char *name);
+/* If false (default), find free pages with a bitmap scan.
+   If true, use the buddy allocator.
+   Controlled by kernel command-line option "-buddy". */
+bool palloc_buddy;
+
+/* If false (default), zero pages only on demand.
+   If true, run a thread that zeroes free pages ahead of time.
+   Controlled by kernel command-line option "-prezero". */
+bool palloc_prezero;
+
+/* If false (default), the kernel and user pools keep their
+   initial sizes.
+   If true, they lend each other pages as needed.
+   Controlled by kernel command-line option "-rebalance". */
+bool palloc_rebalance;
+
+/* Limits on pool sizes under -rebalance. */
+static size_t kernel_reserve;           /* Minimum kernel pool size. */
+static size_t user_page_max;            /* Maximum user pool size. */
+
+/* Wakes the zeroing thread; see zero_thread(). */
+static struct semaphore zero_wanted;
+static bool zero_thread_asleep;
+
+static void init_pool (struct pool *, void *used_map, void *order_map,
+                       void *base, bool reversed, size_t span_cnt,
+                       size_t page_cnt, const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static struct pool *page_to_pool (void *page);
+static void *pool_page (const struct pool *, size_t page_idx,
+                        size_t page_cnt);
+static size_t pool_index (const struct pool *, const void *pages,
+                          size_t page_cnt);
+static void *pool_get (struct pool *, enum palloc_flags, size_t page_cnt);
+static size_t pool_alloc (struct pool *, size_t page_cnt);
+static void pool_count_used (struct pool *, size_t page_cnt);
+static bool pool_borrow (struct pool *);
+static void chunk_take (struct pool *, size_t chunk_idx);
+static void chunk_give (struct pool *);
+static void pool_release (struct pool *, size_t page_idx, size_t page_cnt);
+static void *hot_pop (struct pool *);
+static void hot_push (struct pool *, void *page);
+static void hot_flush (struct pool *, size_t cnt);
+static void *hot_take_cold (struct pool *);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void buddy_free (struct pool *, size_t page_idx, size_t page_cnt);
+static void buddy_free_block (struct pool *, size_t page_idx, int order);
+static void buddy_insert (struct pool *, size_t page_idx, int order);
+static void buddy_remove (struct pool *, size_t page_idx, int order);
+static void *zeroed_pop (struct pool *);
+static void zeroed_flush (struct pool *);
+static void zero_wake (struct pool *, size_t low);
+static thread_func zero_thread NO_RETURN;
+static void print_pool_stats (const struct pool *);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -49,16 +193,42 @@ palloc_init (size_t user_page_limit)
   uint8_t *free_start = ptov (1024 * 1024);
   uint8_t *free_end = ptov (init_ram_pages * PGSIZE);
   size_t free_pages = (free_end - free_start) / PGSIZE;
-  size_t user_pages = free_pages / 2;
-  size_t kernel_pages;
+
+  /* We'll put both pools' used_maps at the start of free memory,
+     followed by their order_maps if the buddy allocator is in
+     use.  Each covers all the pages that follow, so that pages
+     can move between the pools.  Calculate the space needed and
+     subtract it from the pages to be managed. */
+  size_t bm_size = bitmap_buf_size (free_pages);
+  size_t om_size = palloc_buddy ? free_pages : 0;
+  size_t meta_pages = DIV_ROUND_UP (2 * (bm_size + om_size), PGSIZE);
+  uint8_t *span;
+  size_t span_pages, user_pages, kernel_pages;
+
+  if (meta_pages > free_pages)
+    PANIC ("Not enough memory for page allocator bitmaps.");
+  span = free_start + meta_pages * PGSIZE;
+  span_pages = free_pages - meta_pages;
+
+  /* Give half of memory to kernel, half to user.  Pages only
+     move between pools in whole chunks. */
+  if (palloc_rebalance)
+    span_pages = ROUND_DOWN (span_pages, CHUNK_PAGES);
+  user_pages = span_pages / 2;
   if (user_pages > user_page_limit)
     user_pages = user_page_limit;
-  kernel_pages = free_pages - user_pages;
+  if (palloc_rebalance)
+    user_pages = ROUND_DOWN (user_pages, CHUNK_PAGES);
+  kernel_pages = span_pages - user_pages;
+  kernel_reserve = ROUND_UP (kernel_pages / 2, CHUNK_PAGES);
+  user_page_max = user_page_limit;
 
-  /* Give half of memory to kernel, half to user. */
-  init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
-  init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
-             user_pages, "user pool");
+  init_pool (&kernel_pool, free_start, free_start + 2 * bm_size,
+             span, false, span_pages, kernel_pages, "kernel pool");
+  init_pool (&user_pool, free_start + bm_size,
+             free_start + 2 * bm_size + om_size,
+             span + span_pages * PGSIZE, true, span_pages, user_pages,
+             "user pool");
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
@@ -72,30 +242,15 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
   void *pages;
-  size_t page_idx;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
-
-  if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
-  else
-    pages = NULL;
-
-  if (pages != NULL) 
-    {
-      if (flags & PAL_ZERO)
-        memset (pages, 0, PGSIZE * page_cnt);
-    }
-  else 
-    {
-      if (flags & PAL_ASSERT)
-        PANIC ("palloc_get: out of pages");
-    }
+  pages = pool_get (pool, flags, page_cnt);
+  while (pages == NULL && pool_borrow (pool))
+    pages = pool_get (pool, flags, page_cnt);
+  if (pages == NULL && (flags & PAL_ASSERT))
+    PANIC ("palloc_get: out of pages");
 
   return pages;
 }
@@ -113,32 +268,124 @@ palloc_get_page (enum palloc_flags flags)
   return palloc_get_multiple (flags, 1);
 }
 
+/* Obtains PAGE_CNT contiguous pages from POOL, as for
+   palloc_get_multiple(), without borrowing any from the other
+   pool.  Returns a null pointer if too few are available. */
+static void *
+pool_get (struct pool *pool, enum palloc_flags flags, size_t page_cnt) 
+{
+  void *pages = NULL;
+  size_t page_idx;
+
+  if (page_cnt == 1)
+    {
+      /* A single zeroed page may be ready and waiting. */
+      if (flags & PAL_ZERO)
+        {
+          pages = zeroed_pop (pool);
+          if (pages != NULL)
+            {
+              pool->zero_avoided++;
+              return pages;
+            }
+        }
+
+      /* Otherwise take a recently freed page. */
+      pages = hot_pop (pool);
+    }
+  else 
+    {
+      page_idx = pool_alloc (pool, page_cnt);
+      if (page_idx == BITMAP_ERROR)
+        {
+          /* The pool's hot and zeroed pages may be in the way. */
+          hot_flush (pool, SIZE_MAX);
+          zeroed_flush (pool);
+          page_idx = pool_alloc (pool, page_cnt);
+        }
+      if (page_idx != BITMAP_ERROR)
+        pages = pool_page (pool, page_idx, page_cnt);
+    }
+
+  if (pages != NULL) 
+    {
+      if (flags & PAL_ZERO)
+        {
+          memset (pages, 0, PGSIZE * page_cnt);
+          pool->zero_filled += page_cnt;
+        }
+    }
+  else if (page_cnt == 1 && !(flags & PAL_ZERO))
+    {
+      /* Fall back to a page that has already been zeroed. */
+      pages = zeroed_pop (pool);
+    }
+
+  return pages;
+}
+
 /* Frees the PAGE_CNT pages starting at PAGES. */
 void
 palloc_free_multiple (void *pages, size_t page_cnt) 
 {
   struct pool *pool;
-  size_t page_idx;
+  enum intr_level old_level;
 
   ASSERT (pg_ofs (pages) == 0);
   if (pages == NULL || page_cnt == 0)
     return;
 
-  if (page_from_pool (&kernel_pool, pages))
-    pool = &kernel_pool;
-  else if (page_from_pool (&user_pool, pages))
-    pool = &user_pool;
-  else
-    NOT_REACHED ();
-
-  page_idx = pg_no (pages) - pg_no (pool->base);
+  pool = page_to_pool (pages);
 
 #ifndef NDEBUG
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
-  ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  if (page_cnt == 1)
+    {
+      hot_push (pool, pages);
+
+      /* Not from the scheduler, which frees a dying thread's page
+         with interrupts off and must not be made to yield. */
+      if (intr_get_level () == INTR_ON)
+        zero_wake (pool, ZERO_TARGET);
+    }
+  else 
+    {
+      old_level = intr_disable ();
+      pool_release (pool, pool_index (pool, pages, page_cnt), page_cnt);
+      intr_set_level (old_level);
+    }
+}
+
+/* Frees the PAGE_CNT single pages in PAGES[], which need not be
+   contiguous or even from the same pool.  Consecutive pages from
+   the same pool are returned to it in a single critical section,
+   bypassing its hot page cache. */
+void
+palloc_free_batch (void *pages[], size_t page_cnt) 
+{
+  size_t i = 0;
+
+  while (i < page_cnt)
+    {
+      struct pool *pool = page_to_pool (pages[i]);
+      enum intr_level old_level;
+      size_t j;
+
+#ifndef NDEBUG
+      for (j = i; j < page_cnt && page_to_pool (pages[j]) == pool; j++)
+        memset (pages[j], 0xcc, PGSIZE);
+#endif
+
+      old_level = intr_disable ();
+      for (; i < page_cnt && page_to_pool (pages[i]) == pool; i++)
+        {
+          ASSERT (pg_ofs (pages[i]) == 0);
+          pool_release (pool, pool_index (pool, pages[i], 1), 1);
+        }
+      intr_set_level (old_level);
+    }
 }
 
 /* Frees the page at PAGE. */
@@ -148,25 +395,582 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
-/* Initializes pool P as starting at START and ending at END,
-   naming it NAME for debugging purposes. */
+/* Starts the thread that zeroes free pages ahead of time, if
+   the -prezero option was given.  Must be called after the
+   thread system has started. */
+void
+palloc_start_zeroing (void) 
+{
+  if (!palloc_prezero)
+    return;
+
+  sema_init (&zero_wanted, 0);
+  thread_create ("palloc-zero", PRI_MIN, zero_thread, NULL);
+}
+
+/* Prints statistics for each pool. */
+void
+palloc_print_stats (void) 
+{
+  print_pool_stats (&kernel_pool);
+  print_pool_stats (&user_pool);
+}
+
+/* Returns the number of free blocks of 2**ORDER pages in the
+   kernel pool, or in the user pool if USER is true.  Always 0
+   unless the buddy allocator is in use. */
+size_t
+palloc_free_block_cnt (bool user, int order) 
+{
+  const struct pool *pool = user ? &user_pool : &kernel_pool;
+
+  ASSERT (order >= 0 && order < BUDDY_ORDERS);
+  return palloc_buddy ? pool->free_blocks[order] : 0;
+}
+
+/* Initializes pool P, naming it NAME for debugging purposes.
+   P manages SPAN_CNT pages, starting at BASE and running upward
+   or, if REVERSED is true, ending at BASE and running downward,
+   of which it owns the first PAGE_CNT.  Its used_map goes in
+   USED_MAP and, if the buddy allocator is in use, its order_map
+   in ORDER_MAP. */
 static void
-init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
+init_pool (struct pool *p, void *used_map, void *order_map,
+           void *base, bool reversed, size_t span_cnt, size_t page_cnt,
+           const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
-  if (bm_pages > page_cnt)
-    PANIC ("Not enough memory in %s for bitmap.", name);
-  page_cnt -= bm_pages;
+  int order;
 
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
   /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
-  p->base = base + bm_pages * PGSIZE;
+  lock_init_adaptive (&p->lock);
+  lock_track (&p->lock, name);
+  p->used_map = bitmap_create_in_buf (span_cnt, used_map,
+                                      bitmap_buf_size (span_cnt));
+  bitmap_set_multiple (p->used_map, page_cnt, span_cnt - page_cnt, true);
+  p->base = base;
+  p->reversed = reversed;
+  p->page_cnt = page_cnt;
+  p->name = name;
+
+  for (order = 0; order < BUDDY_ORDERS; order++)
+    {
+      list_init (&p->free_lists[order]);
+      p->free_blocks[order] = 0;
+    }
+  list_init (&p->hot);
+  p->hot_cnt = 0;
+  list_init (&p->zeroed);
+  p->zeroed_cnt = 0;
+  p->used_cnt = p->used_peak = 0;
+  p->chunks_borrowed = 0;
+  p->zero_avoided = p->zero_filled = 0;
+  if (palloc_buddy)
+    {
+      p->order_map = order_map;
+      memset (p->order_map, 0, span_cnt);
+      buddy_free (p, 0, page_cnt);
+    }
+}
+
+/* Prints statistics for pool P. */
+static void
+print_pool_stats (const struct pool *p) 
+{
+  int order;
+
+  printf ("%s: %zu of %zu pages free, %zu used at peak", p->name,
+          p->page_cnt - p->used_cnt, p->page_cnt, p->used_peak);
+  if (palloc_rebalance)
+    printf (", %d chunks borrowed", p->chunks_borrowed);
+  printf (", %zu cached", p->hot_cnt);
+  if (palloc_prezero)
+    printf (", %zu pre-zeroed", p->zeroed_cnt);
+  printf (", %llu zero-fills avoided, %llu on demand",
+          p->zero_avoided, p->zero_filled);
+  if (palloc_buddy)
+    {
+      printf (", free blocks by order:");
+      for (order = 0; order < BUDDY_ORDERS; order++)
+        printf (" %zu", p->free_blocks[order]);
+    }
+  printf ("\n");
+}
+
+/* Removes and returns a page from P's list of zeroed pages, or
+   returns a null pointer if the list is empty.  Wakes the
+   zeroing thread if the list is running low. */
+static void *
+zeroed_pop (struct pool *p) 
+{
+  struct list_elem *e = NULL;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (!list_empty (&p->zeroed))
+    {
+      e = list_pop_front (&p->zeroed);
+      p->zeroed_cnt--;
+    }
+  zero_wake (p, ZERO_LOW);
+  intr_set_level (old_level);
+
+  if (e != NULL)
+    memset (e, 0, sizeof *e);
+  return e;
+}
+
+/* Returns all of the pages on P's list of zeroed pages to P's
+   allocator. */
+static void
+zeroed_flush (struct pool *p) 
+{
+  enum intr_level old_level = intr_disable ();
+
+  while (!list_empty (&p->zeroed))
+    {
+      void *page = list_pop_front (&p->zeroed);
+      p->zeroed_cnt--;
+      pool_release (p, pool_index (p, page, 1), 1);
+    }
+  intr_set_level (old_level);
+}
+
+/* Wakes the zeroing thread if it is asleep and P holds fewer
+   than LOW zeroed pages. */
+static void
+zero_wake (struct pool *p, size_t low) 
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (palloc_prezero && p->zeroed_cnt < low && zero_thread_asleep)
+    {
+      zero_thread_asleep = false;
+      sema_up (&zero_wanted);
+    }
+  intr_set_level (old_level);
+}
+
+/* Takes the coldest page out of P's hot page cache and returns
+   it, or returns a null pointer if the cache is empty. */
+static void *
+hot_take_cold (struct pool *p) 
+{
+  struct list_elem *e = NULL;
+  enum intr_level old_level = intr_disable ();
+
+  if (!list_empty (&p->hot))
+    {
+      e = list_pop_back (&p->hot);
+      p->hot_cnt--;
+    }
+  intr_set_level (old_level);
+  return e;
+}
+
+/* Zeroes freed pages from the pools' hot page caches and puts
+   them on the pools' zeroed lists, until each list holds
+   ZERO_TARGET pages or its pool's cache is empty, then sleeps
+   until a page is freed or a list runs low.  Runs at the lowest
+   priority, so that it only uses otherwise idle time. */
+static void
+zero_thread (void *aux UNUSED) 
+{
+  if (thread_mlfqs)
+    thread_set_nice (NICE_MAX);
+
+  for (;;)
+    {
+      struct pool *pool = NULL;
+      enum intr_level old_level;
+      void *page;
+
+      /* Pick a pool that wants more zeroed pages and take one of
+         its freed pages, or sleep if there is none. */
+      if (kernel_pool.zeroed_cnt < ZERO_TARGET)
+        {
+          pool = &kernel_pool;
+          page = hot_take_cold (pool);
+        }
+      else
+        page = NULL;
+      if (page == NULL && user_pool.zeroed_cnt < ZERO_TARGET)
+        {
+          pool = &user_pool;
+          page = hot_take_cold (pool);
+        }
+      if (page == NULL)
+        {
+          old_level = intr_disable ();
+          zero_thread_asleep = true;
+          sema_down (&zero_wanted);
+          intr_set_level (old_level);
+          continue;
+        }
+
+      memset (page, 0, PGSIZE);
+
+      old_level = intr_disable ();
+      list_push_back (&pool->zeroed, page);
+      pool->zeroed_cnt++;
+      intr_set_level (old_level);
+    }
+}
+
+/* Takes PAGE_CNT contiguous free pages from P's allocator and
+   returns the index of the first, or BITMAP_ERROR if P does not
+   have that many contiguous free pages. */
+static size_t
+pool_alloc (struct pool *p, size_t page_cnt) 
+{
+  size_t page_idx;
+
+  if (palloc_buddy)
+    {
+      enum intr_level old_level = intr_disable ();
+      page_idx = buddy_alloc (p, page_cnt);
+      intr_set_level (old_level);
+    }
+  else
+    {
+      lock_acquire (&p->lock);
+      page_idx = bitmap_scan_and_flip (p->used_map, 0, page_cnt, false);
+      lock_release (&p->lock);
+    }
+  if (page_idx != BITMAP_ERROR)
+    pool_count_used (p, page_cnt);
+  return page_idx;
+}
+
+/* Adds PAGE_CNT to P's count of used pages. */
+static void
+pool_count_used (struct pool *p, size_t page_cnt) 
+{
+  enum intr_level old_level = intr_disable ();
+
+  p->used_cnt += page_cnt;
+  if (p->used_cnt > p->used_peak)
+    p->used_peak = p->used_cnt;
+  intr_set_level (old_level);
+}
+
+/* Tries to move the CHUNK_PAGES pages at the boundary between
+   the pools from the other pool to P.  Returns true if
+   successful, false if rebalancing is disabled, P may not grow,
+   or the other pool cannot spare the pages. */
+static bool
+pool_borrow (struct pool *p) 
+{
+  struct pool *lender = p == &kernel_pool ? &user_pool : &kernel_pool;
+  size_t lender_min = lender == &kernel_pool ? kernel_reserve : 0;
+  enum intr_level old_level;
+  bool success = false;
+
+  if (!palloc_rebalance
+      || (p == &user_pool && p->page_cnt + CHUNK_PAGES > user_page_max))
+    return false;
+
+  /* The lender's hot and zeroed pages may be in the way. */
+  hot_flush (lender, SIZE_MAX);
+  zeroed_flush (lender);
+
+  lock_acquire (&kernel_pool.lock);
+  lock_acquire (&user_pool.lock);
+  old_level = intr_disable ();
+  if (lender->page_cnt >= lender_min + CHUNK_PAGES
+      && lender->page_cnt - lender->used_cnt >= CHUNK_PAGES + LEND_WATERMARK)
+    {
+      size_t chunk_idx = lender->page_cnt - CHUNK_PAGES;
+
+      if (bitmap_none (lender->used_map, chunk_idx, CHUNK_PAGES))
+        {
+          chunk_take (lender, chunk_idx);
+          chunk_give (p);
+          lender->chunks_borrowed--;
+          p->chunks_borrowed++;
+          success = true;
+        }
+    }
+  intr_set_level (old_level);
+  lock_release (&user_pool.lock);
+  lock_release (&kernel_pool.lock);
+
+  return success;
+}
+
+/* Removes the free chunk at CHUNK_IDX, which must be the last
+   one that P owns, from P.  Interrupts must be off. */
+static void
+chunk_take (struct pool *p, size_t chunk_idx) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (chunk_idx % CHUNK_PAGES == 0);
+  ASSERT (chunk_idx + CHUNK_PAGES == p->page_cnt);
+
+  p->page_cnt = chunk_idx;
+  bitmap_set_multiple (p->used_map, chunk_idx, CHUNK_PAGES, true);
+  if (palloc_buddy)
+    {
+      /* The chunk lies within a single free block, because free
+         buddies are always merged.  Remove the block and free
+         whatever part of it precedes the chunk. */
+      int order;
+
+      for (order = CHUNK_ORDER; order < BUDDY_ORDERS; order++)
+        {
+          size_t block_idx = chunk_idx & ~(((size_t) 1 << order) - 1);
+          if (p->order_map[block_idx] == order + 1)
+            {
+              buddy_remove (p, block_idx, order);
+              buddy_free (p, block_idx, chunk_idx - block_idx);
+              return;
+            }
+        }
+      NOT_REACHED ();
+    }
+}
+
+/* Adds a free chunk to P, following the last page that P owns.
+   Interrupts must be off. */
+static void
+chunk_give (struct pool *p) 
+{
+  size_t chunk_idx = p->page_cnt;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (chunk_idx % CHUNK_PAGES == 0);
+
+  p->page_cnt += CHUNK_PAGES;
+  bitmap_set_multiple (p->used_map, chunk_idx, CHUNK_PAGES, false);
+  if (palloc_buddy)
+    buddy_free (p, chunk_idx, CHUNK_PAGES);
+}
+
+/* Returns the PAGE_CNT pages starting at PAGE_IDX to P's
+   allocator.  Interrupts must be off. */
+static void
+pool_release (struct pool *p, size_t page_idx, size_t page_cnt) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (bitmap_all (p->used_map, page_idx, page_cnt));
+
+  bitmap_set_multiple (p->used_map, page_idx, page_cnt, false);
+  if (palloc_buddy)
+    buddy_free (p, page_idx, page_cnt);
+  p->used_cnt -= page_cnt;
+}
+
+/* Removes and returns a page from P's hot page cache, refilling
+   the cache from P's allocator with up to HOT_BATCH pages if it
+   is empty.  Returns a null pointer if P has no free pages. */
+static void *
+hot_pop (struct pool *p) 
+{
+  void *pages[HOT_BATCH];
+  enum intr_level old_level;
+  size_t cnt = 0;
+  size_t i;
+
+  old_level = intr_disable ();
+  if (!list_empty (&p->hot))
+    {
+      struct list_elem *e = list_pop_front (&p->hot);
+      p->hot_cnt--;
+      intr_set_level (old_level);
+      return e;
+    }
+  intr_set_level (old_level);
+
+  /* Refill the cache in a single trip to the allocator. */
+  if (palloc_buddy)
+    {
+      old_level = intr_disable ();
+      while (cnt < HOT_BATCH)
+        {
+          size_t page_idx = buddy_alloc (p, 1);
+          if (page_idx == BITMAP_ERROR)
+            break;
+          pages[cnt++] = pool_page (p, page_idx, 1);
+        }
+      intr_set_level (old_level);
+    }
+  else 
+    {
+      lock_acquire (&p->lock);
+      while (cnt < HOT_BATCH)
+        {
+          size_t page_idx = bitmap_scan_and_flip (p->used_map, 0, 1, false);
+          if (page_idx == BITMAP_ERROR)
+            break;
+          pages[cnt++] = pool_page (p, page_idx, 1);
+        }
+      lock_release (&p->lock);
+    }
+  if (cnt == 0)
+    return NULL;
+  pool_count_used (p, cnt);
+
+  old_level = intr_disable ();
+  for (i = 1; i < cnt; i++)
+    list_push_back (&p->hot, pages[i]);
+  p->hot_cnt += cnt - 1;
+  intr_set_level (old_level);
+  return pages[0];
+}
+
+/* Adds PAGE, which has just been freed, to P's hot page cache,
+   first flushing the coldest HOT_BATCH pages to P's allocator if
+   the cache is full. */
+static void
+hot_push (struct pool *p, void *page) 
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (p->hot_cnt >= HOT_MAX)
+    hot_flush (p, HOT_BATCH);
+  list_push_front (&p->hot, page);
+  p->hot_cnt++;
+  intr_set_level (old_level);
+}
+
+/* Returns up to CNT of the coldest pages in P's hot page cache
+   to P's allocator. */
+static void
+hot_flush (struct pool *p, size_t cnt) 
+{
+  enum intr_level old_level = intr_disable ();
+
+  while (cnt-- > 0 && !list_empty (&p->hot))
+    {
+      void *page = list_pop_back (&p->hot);
+      p->hot_cnt--;
+      pool_release (p, pool_index (p, page, 1), 1);
+    }
+  intr_set_level (old_level);
+}
+
+/* Returns the smallest order whose blocks hold PAGE_CNT pages. */
+static int
+buddy_order (size_t page_cnt) 
+{
+  int order = 0;
+
+  while (((size_t) 1 << order) < page_cnt)
+    order++;
+  return order;
+}
+
+/* Allocates PAGE_CNT contiguous pages from P's buddy allocator
+   and returns the index of the first, or BITMAP_ERROR if no
+   large enough block is free.  Interrupts must be off. */
+static size_t
+buddy_alloc (struct pool *p, size_t page_cnt) 
+{
+  int order = buddy_order (page_cnt);
+  int k;
+  size_t page_idx;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  /* Find the smallest free block that is big enough. */
+  for (k = order; k < BUDDY_ORDERS; k++)
+    if (!list_empty (&p->free_lists[k]))
+      break;
+  if (k >= BUDDY_ORDERS)
+    return BITMAP_ERROR;
+  page_idx = pool_index (p, list_front (&p->free_lists[k]), 1);
+  buddy_remove (p, page_idx, k);
+
+  /* Split it down to the order we need, freeing the upper
+     halves, then free the pages beyond PAGE_CNT. */
+  while (k > order)
+    {
+      k--;
+      buddy_insert (p, page_idx + ((size_t) 1 << k), k);
+    }
+  buddy_free (p, page_idx + page_cnt, ((size_t) 1 << order) - page_cnt);
+
+  bitmap_set_multiple (p->used_map, page_idx, page_cnt, true);
+  return page_idx;
+}
+
+/* Returns the PAGE_CNT pages starting at PAGE_IDX to P's buddy
+   allocator, as the largest aligned blocks that cover them.
+   Interrupts must be off. */
+static void
+buddy_free (struct pool *p, size_t page_idx, size_t page_cnt) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (page_cnt > 0)
+    {
+      int order = 0;
+
+      while (order + 1 < BUDDY_ORDERS
+             && page_idx % ((size_t) 1 << (order + 1)) == 0
+             && ((size_t) 1 << (order + 1)) <= page_cnt)
+        order++;
+      buddy_free_block (p, page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
+/* Returns the block of 2**ORDER pages at PAGE_IDX to P's buddy
+   allocator, merging it with its buddy for as long as the buddy
+   is free. */
+static void
+buddy_free_block (struct pool *p, size_t page_idx, int order) 
+{
+  while (order + 1 < BUDDY_ORDERS)
+    {
+      size_t buddy_idx = page_idx ^ ((size_t) 1 << order);
+      if (buddy_idx >= p->page_cnt || p->order_map[buddy_idx] != order + 1)
+        break;
+      buddy_remove (p, buddy_idx, order);
+      if (buddy_idx < page_idx)
+        page_idx = buddy_idx;
+      order++;
+    }
+  buddy_insert (p, page_idx, order);
+}
+
+/* Adds the free block of 2**ORDER pages at PAGE_IDX to P's free
+   lists. */
+static void
+buddy_insert (struct pool *p, size_t page_idx, int order) 
+{
+  struct list_elem *e = pool_page (p, page_idx, 1);
+
+  p->order_map[page_idx] = order + 1;
+  list_push_front (&p->free_lists[order], e);
+  p->free_blocks[order]++;
+}
+
+/* Removes the free block of 2**ORDER pages at PAGE_IDX from P's
+   free lists. */
+static void
+buddy_remove (struct pool *p, size_t page_idx, int order) 
+{
+  struct list_elem *e = pool_page (p, page_idx, 1);
+
+  ASSERT (p->order_map[page_idx] == order + 1);
+  p->order_map[page_idx] = 0;
+  list_remove (e);
+  p->free_blocks[order]--;
+}
+
+/* Returns the pool that PAGE was allocated from. */
+static struct pool *
+page_to_pool (void *page) 
+{
+  if (page_from_pool (&kernel_pool, page))
+    return &kernel_pool;
+  else if (page_from_pool (&user_pool, page))
+    return &user_pool;
+  else
+    NOT_REACHED ();
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -175,8 +979,30 @@ static bool
 page_from_pool (const struct pool *pool, void *page) 
 {
   size_t page_no = pg_no (page);
-  size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  size_t start_page = pg_no (pool_page (pool, 0, pool->page_cnt));
+  size_t end_page = start_page + pool->page_cnt;
 
   return page_no >= start_page && page_no < end_page;
 }
+
+/* Returns the lowest address of the PAGE_CNT pages starting at
+   index PAGE_IDX in P. */
+static void *
+pool_page (const struct pool *p, size_t page_idx, size_t page_cnt) 
+{
+  if (p->reversed)
+    return p->base - PGSIZE * (page_idx + page_cnt);
+  else
+    return p->base + PGSIZE * page_idx;
+}
+
+/* Returns the index in P of the first of the PAGE_CNT pages
+   whose lowest address is PAGES. */
+static size_t
+pool_index (const struct pool *p, const void *pages, size_t page_cnt) 
+{
+  if (p->reversed)
+    return pg_no (p->base) - pg_no (pages) - page_cnt;
+  else
+    return pg_no (pages) - pg_no (p->base);
+}
@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 /* How to allocate pages. */
@@ -11,10 +12,20 @@ enum palloc_flags
     PAL_USER = 004              /* User page. */
   };
 
+/* Use the buddy allocator?  Zero pages ahead of time?  Move
+   pages between the kernel and user pools?  See palloc.c. */
+extern bool palloc_buddy;
+extern bool palloc_prezero;
+extern bool palloc_rebalance;
+
 void palloc_init (size_t user_page_limit);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+void palloc_free_batch (void *[], size_t page_cnt);
+void palloc_start_zeroing (void);
+void palloc_print_stats (void);
+size_t palloc_free_block_cnt (bool user, int order);
 
 #endif /* threads/palloc.h */
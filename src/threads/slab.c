@@ -0,0 +1,260 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
+
+/* Object caches.
+
+   malloc() rounds every request up to a power of 2, so an
+   object a little larger than a power of 2 wastes nearly half
+   of its block.  An object cache instead serves objects of one
+   exact size, for a single frequently allocated type.
+
+   Each page that a cache obtains from the page allocator, called
+   a "slab", begins with a small header followed by as many
+   objects as fit.  The cache keeps all of its free objects on a
+   single free list.  As in malloc(), a slab whose objects are
+   all free is removed from the free list and returned to the
+   page allocator.
+
+   A cache may have a constructor, which is run on each object
+   once, when the object's slab is created, not on every
+   allocation.  Objects must therefore be returned to the cache
+   in their constructed state.  So that the free list does not
+   disturb that state, a cache with a constructor keeps each
+   object's free list link just past the object rather than
+   inside it. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Slab header. */
+struct slab 
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    size_t free_cnt;            /* Free objects in this slab. */
+  };
+
+/* All initialized caches, for kmem_print_stats(). */
+static struct list all_caches = LIST_INITIALIZER (all_caches);
+
+static bool slab_grow (struct kmem_cache *);
+static struct slab *obj_to_slab (struct kmem_cache *, void *);
+static void *slab_to_obj (struct kmem_cache *, struct slab *, size_t idx);
+static size_t malloc_page_cnt (size_t size, size_t cnt);
+
+/* Initializes cache C to hand out objects of SIZE bytes.  If
+   CTOR is non-null, it is called on each object when the
+   object is first carved out.  NAME identifies the cache in
+   statistics and must remain valid as long as the cache. */
+void
+kmem_cache_init (struct kmem_cache *c, const char *name, size_t size,
+                 kmem_ctor_func *ctor) 
+{
+  ASSERT (c != NULL);
+  ASSERT (name != NULL);
+  ASSERT (size > 0);
+
+  c->name = name;
+  c->obj_size = size;
+  if (ctor != NULL)
+    {
+      c->link_ofs = ROUND_UP (size, sizeof (void *));
+      c->block_size = c->link_ofs + sizeof (struct list_elem);
+    }
+  else 
+    {
+      c->link_ofs = 0;
+      c->block_size = ROUND_UP (size, sizeof (void *));
+      if (c->block_size < sizeof (struct list_elem))
+        c->block_size = sizeof (struct list_elem);
+    }
+  c->objs_per_slab = (PGSIZE - sizeof (struct slab)) / c->block_size;
+  ASSERT (c->objs_per_slab > 0);
+  c->ctor = ctor;
+  list_init (&c->free_list);
+  lock_init_adaptive (&c->lock);
+  lock_track (&c->lock, name);
+
+  c->slab_cnt = 0;
+  c->in_use = 0;
+  c->peak_in_use = 0;
+  c->alloc_cnt = 0;
+  c->alloc_cycles = 0;
+  list_push_back (&all_caches, &c->elem);
+}
+
+/* Obtains and returns an object from cache C.  Returns a null
+   pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c) 
+{
+  uint64_t start = timer_cycles ();
+  uint8_t *obj;
+
+  ASSERT (c != NULL);
+
+  lock_acquire (&c->lock);
+
+  /* If the free list is empty, create a new slab. */
+  if (list_empty (&c->free_list) && !slab_grow (c))
+    {
+      lock_release (&c->lock);
+      return NULL;
+    }
+
+  /* Get an object from the free list and return it. */
+  obj = (uint8_t *) list_pop_front (&c->free_list) - c->link_ofs;
+  obj_to_slab (c, obj)->free_cnt--;
+  if (++c->in_use > c->peak_in_use)
+    c->peak_in_use = c->in_use;
+  c->alloc_cnt++;
+  c->alloc_cycles += timer_cycles () - start;
+  lock_release (&c->lock);
+  return obj;
+}
+
+/* Returns OBJ, which must have been obtained from cache C, to
+   C.  If C has a constructor, OBJ must be in its constructed
+   state.  Does nothing if OBJ is a null pointer. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj_) 
+{
+  uint8_t *obj = obj_;
+  struct slab *s;
+
+  ASSERT (c != NULL);
+
+  if (obj == NULL)
+    return;
+
+  s = obj_to_slab (c, obj);
+
+#ifndef NDEBUG
+  /* Clear the object to help detect use-after-free bugs, unless
+     the constructed state must be preserved. */
+  if (c->ctor == NULL)
+    memset (obj, 0xcc, c->obj_size);
+#endif
+
+  lock_acquire (&c->lock);
+
+  /* Add object to free list. */
+  list_push_front (&c->free_list, (struct list_elem *) (obj + c->link_ofs));
+  c->in_use--;
+
+  /* If the slab is now entirely unused, free it. */
+  if (++s->free_cnt >= c->objs_per_slab) 
+    {
+      size_t i;
+
+      ASSERT (s->free_cnt == c->objs_per_slab);
+      for (i = 0; i < c->objs_per_slab; i++)
+        list_remove ((struct list_elem *) ((uint8_t *) slab_to_obj (c, s, i)
+                                           + c->link_ofs));
+      palloc_free_page (s);
+      c->slab_cnt--;
+    }
+
+  lock_release (&c->lock);
+}
+
+/* Prints statistics for each cache: how much memory its peak
+   population occupied, compared with what malloc() would have
+   needed for the same objects, and the average cost of an
+   allocation. */
+void
+kmem_print_stats (void) 
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&all_caches); e != list_end (&all_caches);
+       e = list_next (e))
+    {
+      struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+      size_t slab_pages = DIV_ROUND_UP (c->peak_in_use, c->objs_per_slab);
+      size_t malloc_pages = malloc_page_cnt (c->obj_size, c->peak_in_use);
+
+      printf ("Slab: %s: %zu-byte objects, %zu in use, %zu peak; "
+              "peak uses %zu pages, vs. %zu with malloc; "
+              "%llu allocations, %llu cycles each\n",
+              c->name, c->obj_size, c->in_use, c->peak_in_use,
+              slab_pages, malloc_pages, c->alloc_cnt,
+              c->alloc_cnt != 0 ? c->alloc_cycles / c->alloc_cnt : 0);
+    }
+}
+
+/* Adds a new slab's objects to C's free list.  Returns true if
+   successful, false if the page allocator is out of memory.  C's
+   lock must be held. */
+static bool
+slab_grow (struct kmem_cache *c) 
+{
+  struct slab *s;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  s = palloc_get_page (0);
+  if (s == NULL)
+    return false;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->free_cnt = c->objs_per_slab;
+  for (i = 0; i < c->objs_per_slab; i++) 
+    {
+      uint8_t *obj = slab_to_obj (c, s, i);
+      if (c->ctor != NULL)
+        c->ctor (obj);
+      list_push_back (&c->free_list, (struct list_elem *) (obj + c->link_ofs));
+    }
+  c->slab_cnt++;
+  return true;
+}
+
+/* Returns the slab that OBJ, an object from cache C, is inside. */
+static struct slab *
+obj_to_slab (struct kmem_cache *c, void *obj) 
+{
+  struct slab *s = pg_round_down (obj);
+
+  /* Check that the slab is valid and belongs to C. */
+  ASSERT (s != NULL);
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == c);
+
+  /* Check that the object is properly aligned for the slab. */
+  ASSERT ((pg_ofs (obj) - sizeof *s) % c->block_size == 0);
+
+  return s;
+}
+
+/* Returns the IDX'th object within slab S of cache C. */
+static void *
+slab_to_obj (struct kmem_cache *c, struct slab *s, size_t idx) 
+{
+  ASSERT (idx < c->objs_per_slab);
+  return (uint8_t *) s + sizeof *s + idx * c->block_size;
+}
+
+/* Returns the number of pages that malloc() would need to hold
+   CNT blocks of SIZE bytes each, packed as tightly as it can.
+   malloc()'s arena header is the same size as a slab header. */
+static size_t
+malloc_page_cnt (size_t size, size_t cnt) 
+{
+  size_t block_size = 16;
+
+  while (block_size < size)
+    block_size *= 2;
+  if (block_size >= PGSIZE / 2)
+    return cnt * DIV_ROUND_UP (size + sizeof (struct slab), PGSIZE);
+  return DIV_ROUND_UP (cnt, (PGSIZE - sizeof (struct slab)) / block_size);
+}
@@ -0,0 +1,39 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <list.h>
+#include <stddef.h>
+#include "threads/synch.h"
+
+/* Initializes a newly carved-out object, OBJ. */
+typedef void kmem_ctor_func (void *obj);
+
+/* Object cache.  Hands out objects of one exact size, carved
+   from pages obtained from the page allocator. */
+struct kmem_cache 
+  {
+    const char *name;           /* Name, for statistics. */
+    size_t obj_size;            /* Size of each object in bytes. */
+    size_t block_size;          /* Bytes per object, with free link. */
+    size_t link_ofs;            /* Offset of free link in block. */
+    size_t objs_per_slab;       /* Number of objects in a slab. */
+    kmem_ctor_func *ctor;       /* Constructor, or null. */
+    struct list free_list;      /* Free objects' links. */
+    struct lock lock;           /* Lock. */
+    struct list_elem elem;      /* Element in list of all caches. */
+
+    /* Statistics. */
+    size_t slab_cnt;                    /* Slabs currently held. */
+    size_t in_use;                      /* Objects currently allocated. */
+    size_t peak_in_use;                 /* Most objects allocated at once. */
+    unsigned long long alloc_cnt;       /* # of allocations. */
+    unsigned long long alloc_cycles;    /* CPU cycles spent allocating. */
+  };
+
+void kmem_cache_init (struct kmem_cache *, const char *name, size_t size,
+                      kmem_ctor_func *);
+void *kmem_cache_alloc (struct kmem_cache *);
+void kmem_cache_free (struct kmem_cache *, void *);
+void kmem_print_stats (void);
+
+#endif /* threads/slab.h */
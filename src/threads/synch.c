@@ -31,6 +31,14 @@
 #include <string.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Number of times a contended short-hold lock yields to its
+   holder before falling back to blocking. */
+#define LOCK_SPIN_YIELDS 4
+
+/* Locks registered with lock_track(), for lock_print_stats(). */
+static struct list tracked_locks = LIST_INITIALIZER (tracked_locks);
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
@@ -68,7 +76,7 @@ sema_down (struct semaphore *sema)
   old_level = intr_disable ();
   while (sema->value == 0) 
     {
-      list_insert_ordered (&sema->waiters, &thread_current ()->elem, &compare_priority, NULL);
+      list_push_back (&sema->waiters, &thread_current ()->elem);
       thread_block ();
     }
   sema->value--;
@@ -115,11 +123,13 @@ sema_up (struct semaphore *sema)
 
   old_level = intr_disable ();
 
+  /* Wake the highest priority waiter, the first one to arrive
+     among equals. */
   if (!list_empty (&sema->waiters)) 
   {
-    list_sort(&sema->waiters, &compare_priority, NULL);
-    thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
+    struct list_elem *e = list_min (&sema->waiters, &compare_priority, NULL);
+    list_remove (e);
+    thread_unblock (list_entry (e, struct thread, elem));
   }
   sema->value++;
 
@@ -129,6 +139,8 @@ sema_up (struct semaphore *sema)
 }
 
 static void sema_test_helper (void *sema_);
+static void lock_claim (struct lock *);
+static void lock_spin (struct lock *);
 
 /* Self-test for semaphores that makes control "ping-pong"
    between a pair of threads.  Insert calls to printf() to see
@@ -187,6 +199,68 @@ lock_init (struct lock *lock)
 
   lock->holder = NULL;
   sema_init (&lock->semaphore, 1);
+  lock->max_priority = PRI_MIN;
+  lock->adaptive = false;
+  lock->acquire_cnt = 0;
+  lock->contended_cnt = 0;
+  lock->blocked_cycles = 0;
+  lock->name = NULL;
+}
+
+/* Initializes LOCK as a short-hold lock, for locks that are only
+   held across a few hundred instructions, such as allocator free
+   lists.  Blocking on such a lock costs far more than the
+   critical section itself.
+
+   On a single CPU the holder can only release the lock while it
+   runs, so rather than spinning, a thread that finds a
+   short-hold lock held by a thread that is ready to run (one
+   that was preempted inside its critical section) donates its
+   priority and yields to the holder a few times before it
+   blocks.  If the holder is itself blocked, it is not going to
+   release the lock soon, so the thread blocks at once.  Under
+   the 4.4BSD scheduler, which does not donate, yielding would
+   not help the holder run, so the lock behaves like a plain
+   lock. */
+void
+lock_init_adaptive (struct lock *lock)
+{
+  lock_init (lock);
+  lock->adaptive = true;
+}
+
+/* Registers LOCK under NAME so that lock_print_stats() reports
+   its acquisition counters.  LOCK and NAME must never be freed. */
+void
+lock_track (struct lock *lock, const char *name)
+{
+  enum intr_level old_level;
+
+  ASSERT (lock != NULL);
+  ASSERT (name != NULL);
+  ASSERT (lock->name == NULL);
+
+  old_level = intr_disable ();
+  lock->name = name;
+  list_push_back (&tracked_locks, &lock->stats_elem);
+  intr_set_level (old_level);
+}
+
+/* Prints statistics for each lock registered with lock_track(). */
+void
+lock_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&tracked_locks); e != list_end (&tracked_locks);
+       e = list_next (e))
+    {
+      struct lock *lock = list_entry (e, struct lock, stats_elem);
+      printf ("Lock %s: %llu acquires, %llu contended, "
+              "%llu cycles blocked\n",
+              lock->name, lock->acquire_cnt, lock->contended_cnt,
+              lock->blocked_cycles);
+    }
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
@@ -200,50 +274,40 @@ lock_init (struct lock *lock)
 void
 lock_acquire (struct lock *lock)
 {
+  struct thread *curr_t = thread_current ();
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
-  struct thread *curr_t = thread_current ();
-  struct thread *lock_holder = lock->holder;
-
-  enum intr_level old_level = intr_disable();
+  old_level = intr_disable ();
 
-  /* Determine if the scheduler is Advanced Scheduler or 4.4BSD Scheduler */
-  if( !thread_mlfqs ) 
-  {
-    /* Determines if there is a lock holder, if their priority is lower than the 
-       current threads priority, and the donation depth is not too great. */
-    if( lock_holder != NULL )
-    {
-      curr_t->depth_of_donation = 0;
-      curr_t->waiting_lock = lock;
-      curr_t->depth_of_donation++;
-
-      thread_donate_priority_chain( curr_t, lock->holder, curr_t->donated_priority, curr_t->depth_of_donation );
-     
-      sema_down(&lock->semaphore);
-
-      thread_recall_priority_chain( curr_t, lock->holder, curr_t->donated_priority, curr_t->depth_of_donation );
-      
-      /* When sema_up called, continue. */
-      lock->holder = curr_t;
-      curr_t->waiting_lock = NULL;
-      curr_t->depth_of_donation = 0;
-    }
-    else
+  if (lock->holder != NULL)
     {
+      uint64_t start = timer_cycles ();
+
+      lock->contended_cnt++;
+      if (lock->adaptive)
+        lock_spin (lock);
+
+      /* Donate priority to the holder, unless the scheduler is the
+         4.4BSD Scheduler, which does not use donation. */
+      if (lock->holder != NULL && !thread_mlfqs)
+        {
+          curr_t->waiting_lock = lock;
+          thread_donate_priority (curr_t, lock);
+        }
+
       sema_down (&lock->semaphore);
-      lock->holder = curr_t;
+      curr_t->waiting_lock = NULL;
+      lock->blocked_cycles += timer_cycles () - start;
     }
-  }
-  else 
-  {
+  else
     sema_down (&lock->semaphore);
-    lock->holder = curr_t;
-  }
+  lock_claim (lock);
 
-  intr_set_level(old_level);
+  intr_set_level (old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -255,18 +319,79 @@ lock_acquire (struct lock *lock)
 bool
 lock_try_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
   bool success;
 
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    lock_claim (lock);
+  intr_set_level (old_level);
+
   return success;
 }
 
+/* Makes the current thread, which has just downed LOCK's
+   semaphore, LOCK's holder.  The threads still waiting for LOCK
+   now donate to the current thread.  Interrupts must be off. */
+static void
+lock_claim (struct lock *lock)
+{
+  struct thread *curr_t = thread_current ();
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  lock->holder = curr_t;
+  lock->acquire_cnt++;
+  lock->max_priority = PRI_MIN;
+  for (e = list_begin (&lock->semaphore.waiters);
+       e != list_end (&lock->semaphore.waiters); e = list_next (e))
+    {
+      struct thread *waiter = list_entry (e, struct thread, elem);
+      if (waiter->donated_priority > lock->max_priority)
+        lock->max_priority = waiter->donated_priority;
+    }
+  list_push_back (&curr_t->held_locks, &lock->elem);
+
+  if (!thread_mlfqs)
+    thread_recompute_priority (curr_t);
+}
+
+/* Gives the holder of short-hold LOCK a chance to leave its
+   critical section, as described at lock_init_adaptive().
+   Returns once LOCK is free, its holder is blocked, or we have
+   yielded LOCK_SPIN_YIELDS times.  Interrupts must be off. */
+static void
+lock_spin (struct lock *lock)
+{
+  int i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (thread_mlfqs)
+    return;
+
+  for (i = 0; i < LOCK_SPIN_YIELDS; i++)
+    {
+      if (lock->holder == NULL || lock->holder->status != THREAD_READY)
+        break;
+
+      /* Without our priority, a lower-priority holder would not
+         run before we are scheduled again.  The donation is
+         undone when the holder releases LOCK. */
+      thread_donate_priority (thread_current (), lock);
+      thread_yield ();
+    }
+}
+
 /* Releases LOCK, which must be owned by the current thread.
+   The current thread gives up the priority donated through LOCK,
+   which takes time proportional to the number of other locks it
+   holds.
 
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to release a lock within an interrupt
@@ -274,17 +399,20 @@ lock_try_acquire (struct lock *lock)
 void
 lock_release (struct lock *lock) 
 {
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   lock->holder = NULL;
+  list_remove (&lock->elem);
 
-  if( thread_current()->donated_thread != NULL )
-  {
-    thread_recall_priority_chain(thread_current(),thread_current()->donated_thread,thread_current()->donated_priority,thread_current()->depth_of_donation);
-  } 
+  if (!thread_mlfqs)
+    thread_recompute_priority (thread_current ());
 
   sema_up (&lock->semaphore);
+  intr_set_level (old_level);
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -298,6 +426,294 @@ lock_held_by_current_thread (const struct lock *lock)
   return lock->holder == thread_current ();
 }
 
+static void rwlock_wait (struct rwlock *, struct list *waiters);
+static void rwlock_wake (struct rwlock *);
+static void rwlock_grant_read (struct rwlock *, struct thread *);
+static void rwlock_grant_write (struct rwlock *, struct thread *);
+static struct rwlock_reader *rwlock_find_reader (const struct rwlock *,
+                                                 struct thread *);
+static int waiters_max_priority (struct list *waiters, int pri);
+
+/* Initializes RW.  A reader-writer lock may be held by any
+   number of readers at once, or by a single writer.
+
+   Writers are preferred over readers: a reader that arrives
+   while a writer is waiting waits too, so a writer never waits
+   for more than the readers that held the lock when it arrived.
+   When the lock comes free, it goes to the highest-priority
+   waiting writer, unless some waiting reader has a strictly
+   higher priority, in which case every waiting reader gets it
+   at once.
+
+   A thread that blocks on RW donates its priority to every
+   current holder, readers included. */
+void
+rwlock_init (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  rw->writer = NULL;
+  rw->reader_cnt = 0;
+  list_init (&rw->readers);
+  list_init (&rw->read_waiters);
+  list_init (&rw->write_waiters);
+  rw->max_priority = PRI_MIN;
+}
+
+/* Acquires RW in shared mode, sleeping until it is available if
+   necessary.  The current thread must not already hold RW in
+   exclusive mode, and may hold at most THREAD_READ_LOCKS
+   reader-writer locks in shared mode at once.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (rw->writer != thread_current ());
+
+  old_level = intr_disable ();
+  if (rw->writer == NULL && list_empty (&rw->write_waiters))
+    rwlock_grant_read (rw, thread_current ());
+  else
+    rwlock_wait (rw, &rw->read_waiters);
+  intr_set_level (old_level);
+}
+
+/* Releases the current thread's shared hold on RW. */
+void
+rwlock_release_read (struct rwlock *rw)
+{
+  struct thread *cur = thread_current ();
+  struct rwlock_reader *reader;
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+
+  old_level = intr_disable ();
+  reader = rwlock_find_reader (rw, cur);
+  ASSERT (reader != NULL);
+  list_remove (&reader->elem);
+  reader->rwlock = NULL;
+  rw->reader_cnt--;
+
+  if (!thread_mlfqs)
+    thread_recompute_priority (cur);
+  if (rw->reader_cnt == 0)
+    rwlock_wake (rw);
+  priority_check_running_vs_ready ();
+  intr_set_level (old_level);
+}
+
+/* Acquires RW in exclusive mode, sleeping until it is available
+   if necessary.  The current thread must not already hold RW in
+   either mode.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!rwlock_held_by_current_thread (rw));
+
+  old_level = intr_disable ();
+  if (rw->writer == NULL && rw->reader_cnt == 0)
+    rwlock_grant_write (rw, thread_current ());
+  else
+    rwlock_wait (rw, &rw->write_waiters);
+  intr_set_level (old_level);
+}
+
+/* Releases RW, which the current thread must hold in exclusive
+   mode. */
+void
+rwlock_release_write (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (rw->writer == thread_current ());
+
+  old_level = intr_disable ();
+  rw->writer = NULL;
+  list_remove (&rw->elem);
+
+  if (!thread_mlfqs)
+    thread_recompute_priority (thread_current ());
+  rwlock_wake (rw);
+  priority_check_running_vs_ready ();
+  intr_set_level (old_level);
+}
+
+/* Returns true if the current thread holds RW in either mode,
+   false otherwise. */
+bool
+rwlock_held_by_current_thread (const struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  return (rw->writer == thread_current ()
+          || rwlock_find_reader (rw, thread_current ()) != NULL);
+}
+
+/* Donates DONOR's priority, which is waiting for RW, to each of
+   RW's current holders.  Interrupts must be off. */
+void
+rwlock_donate (struct rwlock *rw, struct thread *donor)
+{
+  int pri = donor->donated_priority;
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (thread_mlfqs || rw->max_priority >= pri)
+    return;
+
+  rw->max_priority = pri;
+  thread_receive_donation (rw->writer, pri);
+  for (e = list_begin (&rw->readers); e != list_end (&rw->readers);
+       e = list_next (e))
+    thread_receive_donation (list_entry (e, struct rwlock_reader,
+                                         elem)->thread, pri);
+}
+
+/* Puts the current thread on RW's WAITERS and sleeps until
+   rwlock_wake() hands RW to it.  Interrupts must be off. */
+static void
+rwlock_wait (struct rwlock *rw, struct list *waiters)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  list_push_back (waiters, &cur->elem);
+  cur->waiting_rwlock = rw;
+  rwlock_donate (rw, cur);
+  thread_block ();
+}
+
+/* Hands RW, which has just become free, to the waiters that
+   should run next, as described at rwlock_init().  Interrupts
+   must be off. */
+static void
+rwlock_wake (struct rwlock *rw)
+{
+  struct thread *writer = NULL;
+  struct thread *reader = NULL;
+  struct list woken;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (rw->writer == NULL && rw->reader_cnt == 0);
+
+  if (!list_empty (&rw->write_waiters))
+    writer = list_entry (list_min (&rw->write_waiters, compare_priority, NULL),
+                         struct thread, elem);
+  if (!list_empty (&rw->read_waiters))
+    reader = list_entry (list_min (&rw->read_waiters, compare_priority, NULL),
+                         struct thread, elem);
+
+  /* Take the threads to wake off the wait lists before
+     recomputing the priority that the rest donate. */
+  list_init (&woken);
+  if (writer != NULL
+      && (reader == NULL
+          || !compare_priority (&reader->elem, &writer->elem, NULL)))
+    {
+      list_remove (&writer->elem);
+      list_push_back (&woken, &writer->elem);
+    }
+  else
+    while (!list_empty (&rw->read_waiters))
+      list_push_back (&woken, list_pop_front (&rw->read_waiters));
+
+  rw->max_priority = waiters_max_priority (&rw->write_waiters,
+                                          waiters_max_priority
+                                          (&rw->read_waiters, PRI_MIN));
+
+  while (!list_empty (&woken))
+    {
+      struct thread *t = list_entry (list_pop_front (&woken),
+                                     struct thread, elem);
+      t->waiting_rwlock = NULL;
+      if (t == writer)
+        rwlock_grant_write (rw, t);
+      else
+        rwlock_grant_read (rw, t);
+      thread_unblock (t);
+    }
+}
+
+/* Gives T a shared hold on RW.  Interrupts must be off. */
+static void
+rwlock_grant_read (struct rwlock *rw, struct thread *t)
+{
+  int i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (i = 0; i < THREAD_READ_LOCKS; i++)
+    if (t->read_locks[i].rwlock == NULL)
+      break;
+  if (i >= THREAD_READ_LOCKS)
+    PANIC ("%s holds too many reader-writer locks", t->name);
+
+  t->read_locks[i].rwlock = rw;
+  t->read_locks[i].thread = t;
+  list_push_back (&rw->readers, &t->read_locks[i].elem);
+  rw->reader_cnt++;
+  if (!thread_mlfqs)
+    thread_recompute_priority (t);
+}
+
+/* Gives T exclusive hold of RW.  Interrupts must be off. */
+static void
+rwlock_grant_write (struct rwlock *rw, struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  rw->writer = t;
+  list_push_back (&t->held_rwlocks, &rw->elem);
+  if (!thread_mlfqs)
+    thread_recompute_priority (t);
+}
+
+/* Returns T's shared hold on RW, or a null pointer if T does not
+   hold RW in shared mode. */
+static struct rwlock_reader *
+rwlock_find_reader (const struct rwlock *rw, struct thread *t)
+{
+  int i;
+
+  for (i = 0; i < THREAD_READ_LOCKS; i++)
+    if (t->read_locks[i].rwlock == rw)
+      return &t->read_locks[i];
+  return NULL;
+}
+
+/* Returns the larger of PRI and the highest donated priority
+   among the threads on WAITERS. */
+static int
+waiters_max_priority (struct list *waiters, int pri)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (waiters); e != list_end (waiters); e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, elem);
+      if (t->donated_priority > pri)
+        pri = t->donated_priority;
+    }
+  return pri;
+}
+
 /* One semaphore in a list. */
 struct semaphore_elem 
   {
@@ -22,14 +22,59 @@ struct lock
   {
     struct thread *holder;      /* Thread holding lock (for debugging). */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
+    int max_priority;           /* Highest priority among waiters. */
+    struct list_elem elem;      /* Element in holder's held_locks. */
+    bool adaptive;              /* Short-hold lock?  See lock_init_adaptive(). */
+
+    /* Statistics. */
+    unsigned long long acquire_cnt;     /* # of acquisitions. */
+    unsigned long long contended_cnt;   /* # that found the lock held. */
+    unsigned long long blocked_cycles;  /* CPU cycles spent waiting. */
+    const char *name;                   /* Name, if tracked. */
+    struct list_elem stats_elem;        /* Element in tracked locks list. */
   };
 
 void lock_init (struct lock *);
+void lock_init_adaptive (struct lock *);
+void lock_track (struct lock *, const char *name);
+void lock_print_stats (void);
 void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
 
+/* Reader-writer lock.  Any number of threads may hold it in
+   shared ("read") mode, or exactly one in exclusive ("write")
+   mode.  Writers are preferred: once a writer is waiting, new
+   readers wait behind it. */
+struct rwlock
+  {
+    struct thread *writer;      /* Exclusive holder, or NULL. */
+    unsigned reader_cnt;        /* Number of shared holders. */
+    struct list readers;        /* Shared holds (struct rwlock_reader). */
+    struct list read_waiters;   /* Threads waiting for shared mode. */
+    struct list write_waiters;  /* Threads waiting for exclusive mode. */
+    int max_priority;           /* Highest priority among waiters. */
+    struct list_elem elem;      /* Element in writer's held_rwlocks. */
+  };
+
+/* One thread's shared hold on a reader-writer lock.  Each thread
+   has a few of these built in; see THREAD_READ_LOCKS. */
+struct rwlock_reader
+  {
+    struct rwlock *rwlock;      /* Lock held, or NULL if unused. */
+    struct thread *thread;      /* Thread holding it. */
+    struct list_elem elem;      /* Element in rwlock's readers. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_held_by_current_thread (const struct rwlock *);
+void rwlock_donate (struct rwlock *, struct thread *donor);
+
 /* Condition variable. */
 struct condition 
   {
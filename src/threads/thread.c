@@ -22,9 +22,18 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Number of distinct thread priorities. */
+#define PRI_CNT (PRI_MAX - PRI_MIN + 1)
+
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running.  There is one FIFO
+   queue per priority, indexed by priority - PRI_MIN.  Bit P of
+   ready_mask is set if and only if ready_queues[P] is nonempty,
+   so that enqueue, dequeue, and finding the highest ready
+   priority all take constant time. */
+static struct list ready_queues[PRI_CNT];
+static uint64_t ready_mask;
+static size_t ready_cnt;        /* # of threads in the ready queues. */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -52,6 +61,22 @@ static long long idle_ticks;    /* # of timer ticks spent idle. */
 static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
 static long long user_ticks;    /* # of timer ticks in user programs. */
 
+/* Dispatch latency histogram: the time from thread_unblock() to
+   the thread's next thread_schedule_tail(), per effective
+   priority at dispatch.  Bucket 0 counts latencies under 2**10
+   cycles, bucket B > 0 latencies in [2**(9+B), 2**(10+B)), and
+   the last bucket everything longer. */
+#define LATENCY_MIN_SHIFT 10
+#define LATENCY_BUCKETS 16
+struct latency_stats
+  {
+    unsigned long long cnt;             /* # of dispatches measured. */
+    unsigned long long total;           /* Sum of latencies. */
+    unsigned long long max;             /* Longest latency. */
+    unsigned hist[LATENCY_BUCKETS];     /* Histogram. */
+  };
+static struct latency_stats dispatch_latency[PRI_CNT];
+
 /* Scheduling. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
 static unsigned thread_ticks;   /* # of timer ticks since last yield. */
@@ -65,12 +90,19 @@ bool thread_mlfqs;
 int load_avg;
 int const INITIAL_LOAD_AVERAGE = 0;
 
-/* Track nested donation depth */
-int const MAX_DONATION_DEPTH = 8;
-
 /* Initial Values for MLFQS */
 int INITIAL_LOAD_AVG = 0;
 
+/* MLFQS recent_cpu decay history.  mlfqs_epoch counts the
+   once-per-second load average updates, and mlfqs_decay[E %
+   MLFQS_HISTORY] is the recent_cpu coefficient applied at epoch
+   E.  Only the running and ready threads are decayed when an
+   epoch ends; blocked threads skip the update and catch up from
+   this history when they next become ready. */
+#define MLFQS_HISTORY 64
+static int64_t mlfqs_epoch;
+static int mlfqs_decay[MLFQS_HISTORY];
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
@@ -82,6 +114,19 @@ static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static int thread_effective_priority (const struct thread *);
+static void ready_queue_push (struct thread *);
+static void ready_queue_remove (struct thread *);
+static struct thread *ready_queue_pop (void);
+static int ready_queue_highest (void);
+static void ready_queue_update (struct thread *);
+static void mlfqs_advance_epoch (struct thread *running);
+static void mlfqs_record_epoch (void);
+static void mlfqs_refresh (struct thread *);
+static int fp_power (int x, int64_t n);
+static void record_dispatch_latency (int priority,
+                                     unsigned long long cycles);
+static void print_thread_cpu (struct thread *, void *aux);
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -100,10 +145,15 @@ void
 thread_init (void) 
 {
 //printf("thread_init.\n"); //TODO
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (i = 0; i < PRI_CNT; i++)
+    list_init (&ready_queues[i]);
+  ready_mask = 0;
+  ready_cnt = 0;
   list_init (&all_list);
 
   /* Set up a thread structure for the running thread. */
@@ -111,6 +161,7 @@ thread_init (void)
   init_thread (initial_thread, "main", PRI_DEFAULT);
   initial_thread->status = THREAD_RUNNING;
   initial_thread->tid = allocate_tid ();
+  initial_thread->run_start = timer_cycles ();
 
   /* Sets value of the initial load average */
   load_avg = INITIAL_LOAD_AVG;
@@ -164,59 +215,20 @@ thread_tick (void)
        t->recent_cpu_time = add_fp_int( t->recent_cpu_time, 1 );
     }
 
-    /* Every fourth tick, recalculate the priority of every thread in the ready queue
-       priority = PRI_MAX - (recent_cpu_time / 4) - (thread_nice * 2)  */
-    if(timer_ticks() % 4 == 0)
-    {
-//printf("thread_tick, 4 ticks.\n"); //TODO
-    struct list_elem *list_parser;
-   
-    for(list_parser = list_begin(&all_list); 
-        list_parser !=list_end(&all_list); 
-        list_parser = list_next(list_parser))
-    {
-      struct thread *updating_thread = list_entry( list_parser, struct thread, allelem );
-
-      updating_thread->priority = calculate_mlfps_priority( updating_thread );
-
-      }//End for - through all_list, updating priority on each
-    }//End if - code every 4 ticks
-
-    /* Check every 1 second */
+    /* Once per second, update load_avg and decay recent_cpu_time
+       of the running and ready threads. */
     if(timer_ticks() % TIMER_FREQ == 0)
-    {
-//printf("thread_tick, every_second.\n"); //TODO
-      /* Once per second, re-calculate load_avg 
-         load_avg = (59/60)*load_avg + (1/60)*ready_threads */
-      int num_of_running_threads = 0,
-           coefficient_of_recent_cpu;
-
-      struct list_elem *list_parser;
-
-      if(t != idle_thread)
-        num_of_running_threads = 1;
-
-      /* Calculate new load_avg */
-      load_avg = add_fp( divide_fp_int( multiply_fp_int(load_avg, 59), 60 ), divide_fp_int( convert_to_fp( list_size(&ready_list) + num_of_running_threads ), 60 ) );
-
-      /* Once per second, re-calculate recent_cpu_time of the current thread 
-         (not idle thread) (can be negative because of negative nice value)
-         recent_cpu_time = (2 * load_avg) / ((2 * load_avg)+1) * recent_cpu_time + thread_nice  */
-      coefficient_of_recent_cpu = divide_fp( multiply_fp_int(load_avg, 2), add_fp_int( multiply_fp_int(load_avg, 2), 1) );
-
-      for(list_parser = list_begin(&all_list); 
-          list_parser !=list_end(&all_list); 
-          list_parser = list_next(list_parser))
-      {
-        struct thread *updating_thread = list_entry( list_parser, struct thread, allelem );
-
-        updating_thread->recent_cpu_time = add_fp_int( 
-                                           multiply_fp( coefficient_of_recent_cpu, updating_thread->recent_cpu_time ),
-                                           updating_thread->thread_nice );
-      }//End for - through all_list, updating recent_cpu_time on each
-
-    }//End if - code every second
+      mlfqs_advance_epoch( t );
 
+    /* Every fourth tick, recalculate the priority of the running thread.
+       It is the only thread whose recent_cpu_time changed since the last
+       recalculation, so no other priority can have moved.
+       priority = PRI_MAX - (recent_cpu_time / 4) - (thread_nice * 2)  */
+    if(timer_ticks() % 4 == 0 && t != idle_thread)
+    {
+      t->priority = calculate_mlfps_priority( t );
+      priority_check_running_vs_ready();
+    }
    }//End if - Multi-Level Feedback Queue Scheduler
   
   /* Enforce preemption. */
@@ -226,12 +238,103 @@ thread_tick (void)
   intr_set_level (old_level);
 }
 
-/* Prints thread statistics. */
+/* Accounts for CNT timer ticks that passed without a timer
+   interrupt while the idle thread was halted in tickless mode.
+   No thread was ready during those ticks, so all that is owed is
+   crediting them as idle time and, under the MLFQS, decaying the
+   load average once for each second boundary they span, which
+   is done here in one step.  Called by the timer code with
+   interrupts off, after the tick count has been advanced past
+   the skipped ticks. */
+void
+thread_skip_ticks (int64_t cnt) 
+{
+  int64_t now = timer_ticks ();
+  int64_t seconds = now / TIMER_FREQ - (now - cnt) / TIMER_FREQ;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  idle_ticks += cnt;
+
+  if (thread_mlfqs && seconds > 0)
+    {
+      /* With no ready threads, each second only multiplies
+         load_avg by 59/60.  Epochs that have already fallen out
+         of the decay history need no coefficient of their own. */
+      int decay = divide_fp_int( convert_to_fp( 59 ), 60 );
+      int64_t recorded = seconds < MLFQS_HISTORY ? seconds : MLFQS_HISTORY;
+
+      load_avg = multiply_fp( fp_power( decay, seconds - recorded ), load_avg );
+      mlfqs_epoch += seconds - recorded;
+      while (recorded-- > 0)
+        {
+          load_avg = multiply_fp( decay, load_avg );
+          mlfqs_record_epoch ();
+        }
+    }
+}
+
+/* Prints thread statistics: tick counts, the CPU accounting of
+   each thread that still exists, and the dispatch latency
+   histogram of each priority that has had any dispatches. */
 void
 thread_print_stats (void) 
 {
+  enum intr_level old_level;
+  int pri, b;
+
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+
+  old_level = intr_disable ();
+  thread_foreach (print_thread_cpu, NULL);
+  intr_set_level (old_level);
+
+  printf ("Thread: dispatch latency in cycles by priority "
+          "(histogram buckets <1K, <2K, ..., <16M, more):\n");
+  for (pri = PRI_MAX; pri >= PRI_MIN; pri--)
+    {
+      const struct latency_stats *ls = &dispatch_latency[pri - PRI_MIN];
+      if (ls->cnt == 0)
+        continue;
+      printf ("  priority %2d: %llu dispatches, avg %llu, max %llu:",
+              pri, ls->cnt, ls->total / ls->cnt, ls->max);
+      for (b = 0; b < LATENCY_BUCKETS; b++)
+        printf (" %u", ls->hist[b]);
+      printf ("\n");
+    }
+}
+
+/* Prints T's CPU accounting, for thread_print_stats(). */
+static void
+print_thread_cpu (struct thread *t, void *aux UNUSED) 
+{
+  printf ("  thread %d (%s): %llu cycles, scheduled %llu times, "
+          "%llu voluntary and %llu involuntary switches\n",
+          t->tid, t->name, t->run_cycles, t->schedule_cnt,
+          t->voluntary_cnt, t->involuntary_cnt);
+}
+
+/* Adds one dispatch of a thread at PRIORITY, CYCLES after it
+   was unblocked, to the dispatch latency histogram. */
+static void
+record_dispatch_latency (int priority, unsigned long long cycles) 
+{
+  struct latency_stats *ls = &dispatch_latency[priority - PRI_MIN];
+  unsigned long long x = cycles >> LATENCY_MIN_SHIFT;
+  int b = 0;
+
+  while (x != 0 && b < LATENCY_BUCKETS - 1)
+    {
+      x >>= 1;
+      b++;
+    }
+
+  ls->cnt++;
+  ls->total += cycles;
+  if (cycles > ls->max)
+    ls->max = cycles;
+  ls->hist[b]++;
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -343,8 +446,11 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_insert_ordered(&ready_list, &t->elem, &compare_priority, NULL);
+  if (thread_mlfqs && t != idle_thread)
+    mlfqs_refresh (t);
   t->status = THREAD_READY;
+  t->ready_start = timer_cycles ();
+  ready_queue_push (t);
   intr_set_level (old_level);
 
 }
@@ -392,6 +498,7 @@ thread_exit (void)
 #ifdef USERPROG
   process_exit ();
 #endif
+  malloc_thread_exit ();
 
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
@@ -415,9 +522,9 @@ thread_yield (void)
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
-  if (cur != idle_thread) 
-    list_insert_ordered (&ready_list, &cur->elem, &compare_priority, NULL);
   cur->status = THREAD_READY;
+  if (cur != idle_thread) 
+    ready_queue_push (cur);
   schedule ();
   intr_set_level (old_level);
 }
@@ -443,32 +550,19 @@ thread_foreach (thread_action_func *func, void *aux)
 void
 thread_set_priority (int new_priority) 
 {
-  bool is_greater = false;
   struct thread *curr_t = thread_current();
  
   if(!thread_mlfqs)
   {
-    if( curr_t->donated_priority < new_priority )
-    {
-      curr_t->donated_priority = new_priority;
-      is_greater = true;
-    }
- 
-    if( curr_t->priority < new_priority )
-    {
-      curr_t->priority = new_priority;
-      is_greater = true;
-    }
+    /* The running thread waits on no lock, so the new priority
+       only has to be combined with what its own locks donate. */
+    enum intr_level old_level = intr_disable ();
 
-    if(is_greater)
-    {
-      if( curr_t->donated_thread )
-      {
-        thread_donate_priority_chain( curr_t, curr_t->donated_thread, new_priority, curr_t->depth_of_donation );
-      }
+    curr_t->priority = new_priority;
+    thread_recompute_priority( curr_t );
+    priority_check_running_vs_ready();
 
-      priority_check_running_vs_ready();
-    }
+    intr_set_level (old_level);
   }
 }
 
@@ -487,15 +581,16 @@ thread_set_nice (int new_nice)
 
   ASSERT( NICE_MIN <= new_nice && new_nice <= NICE_MAX );
 
-  int temp_nice = curr_t->thread_nice;
+  enum intr_level old_level = intr_disable ();
   curr_t->thread_nice = new_nice;
 
   /* Calculate new priority */
-//  calculate_mlfps_priority(curr_t);
+  if( thread_mlfqs )
+    mlfqs_refresh( curr_t );
 
   /* Check to see if the running thread should yield to higher priority */
-//  if( temp_nice < new_nice )
-//    priority_check_running_vs_ready();  
+  priority_check_running_vs_ready();  
+  intr_set_level (old_level);
 }
 
 /* Returns the current thread's nice value. */
@@ -541,6 +636,10 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* In tickless mode, stop the periodic timer until the next
+         tick that has work to do. */
+      timer_idle_enter ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -607,11 +706,21 @@ init_thread (struct thread *t, const char *name, int priority)
   t->priority = priority;
   t->donated_priority = priority;
   t->magic = THREAD_MAGIC;
-  t->depth_of_donation = 0;
+  list_init (&t->held_locks);
+  list_init (&t->held_rwlocks);
+#ifdef USERPROG
+  list_init (&t->children);
+  list_init (&t->fds);
+  t->next_handle = 2;
+#endif
+#ifdef VM
+  list_init (&t->mappings);
+#endif
   t->thread_nice = NICE_DEFAULT;  
+  t->recent_cpu_epoch = mlfqs_epoch;
   
   old_level = intr_disable ();
-  list_insert_ordered (&all_list, &t->allelem, &compare_priority, NULL); 
+  list_push_back (&all_list, &t->allelem);
   intr_set_level (old_level);
 }
 
@@ -636,10 +745,102 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
+  if (ready_mask == 0)
     return idle_thread;
   else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+    return ready_queue_pop ();
+}
+
+/* Returns the priority T is scheduled at: its computed priority
+   under the MLFQS scheduler, otherwise its base priority plus
+   any donations. */
+static int
+thread_effective_priority (const struct thread *t) 
+{
+  return thread_mlfqs ? t->priority : t->donated_priority;
+}
+
+/* Appends ready thread T to the back of the ready queue for its
+   effective priority.  Interrupts must be off. */
+static void
+ready_queue_push (struct thread *t) 
+{
+  int pri = thread_effective_priority (t);
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_READY);
+  ASSERT (PRI_MIN <= pri && pri <= PRI_MAX);
+
+  t->ready_priority = pri;
+  list_push_back (&ready_queues[pri - PRI_MIN], &t->elem);
+  ready_mask |= (uint64_t) 1 << (pri - PRI_MIN);
+  ready_cnt++;
+}
+
+/* Removes ready thread T from its ready queue.  Interrupts must
+   be off. */
+static void
+ready_queue_remove (struct thread *t) 
+{
+  int idx = t->ready_priority - PRI_MIN;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_READY);
+
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[idx]))
+    ready_mask &= ~((uint64_t) 1 << idx);
+  ready_cnt--;
+}
+
+/* Removes and returns the thread at the front of the highest
+   priority nonempty ready queue.  At least one thread must be
+   ready.  Interrupts must be off. */
+static struct thread *
+ready_queue_pop (void) 
+{
+  int pri = ready_queue_highest ();
+  struct thread *t;
+
+  ASSERT (pri >= PRI_MIN);
+
+  t = list_entry (list_front (&ready_queues[pri - PRI_MIN]),
+                  struct thread, elem);
+  ready_queue_remove (t);
+  return t;
+}
+
+/* Returns the highest priority of any ready thread, or
+   PRI_MIN - 1 if no thread is ready. */
+static int
+ready_queue_highest (void) 
+{
+  uint32_t hi = ready_mask >> 32;
+  uint32_t lo = ready_mask;
+
+  if (hi != 0)
+    return PRI_MIN + 63 - __builtin_clz (hi);
+  else if (lo != 0)
+    return PRI_MIN + 31 - __builtin_clz (lo);
+  else
+    return PRI_MIN - 1;
+}
+
+/* Moves T to the ready queue matching its current effective
+   priority, if T is ready and its priority has changed since it
+   was queued.  Call after changing a thread's priority or
+   donated priority.  Interrupts must be off. */
+static void
+ready_queue_update (struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t->status == THREAD_READY
+      && t->ready_priority != thread_effective_priority (t))
+    {
+      ready_queue_remove (t);
+      ready_queue_push (t);
+    }
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -668,6 +869,17 @@ thread_schedule_tail (struct thread *prev)
   /* Mark us as running. */
   cur->status = THREAD_RUNNING;
 
+  /* Account for the dispatch. */
+  cur->run_start = timer_cycles ();
+  if (prev != NULL)
+    cur->schedule_cnt++;
+  if (cur->ready_start != 0)
+    {
+      record_dispatch_latency (thread_effective_priority (cur),
+                               cur->run_start - cur->ready_start);
+      cur->ready_start = 0;
+    }
+
   /* Start new time slice. */
   thread_ticks = 0;
 
@@ -706,8 +918,24 @@ schedule (void)
   ASSERT (cur->status != THREAD_RUNNING);
   ASSERT (is_thread (next));
 
+  /* The idle thread may have left the timer in one-shot mode.
+     Catch up on the ticks that passed and restore the periodic
+     timer before anything else runs. */
+  if (cur == idle_thread)
+    timer_idle_exit ();
+
+  /* Charge CUR for its time on the CPU.  Leaving while still
+     ready means it was preempted; otherwise it blocked or
+     exited. */
+  cur->run_cycles += timer_cycles () - cur->run_start;
   if (cur != next)
-    prev = switch_threads (cur, next);
+    {
+      if (cur->status == THREAD_READY)
+        cur->involuntary_cnt++;
+      else
+        cur->voluntary_cnt++;
+      prev = switch_threads (cur, next);
+    }
   thread_schedule_tail (prev);
 }
 
@@ -729,43 +957,7 @@ allocate_tid (void)
    Used by switch.S, which can't figure it out on its own. */
 uint32_t thread_stack_ofs = offsetof (struct thread, stack);
 
-/* list_less_func to compare the wakeup_ticks and priority of the two list elements,
-   if first_list_elem has lower wakeup_ticks, returns true
-   if first_list_elem has higher wakeup_ticks, returns false
-   if first_list_elem and second_list_elem have the same wakeup_ticks, checks priority,
-     if first_list_elem has higher priority returns true, else returns false
-   aligns to a first come first served list, if the two elements have the same wakeup time,
-     and the same priority.
-   */
-bool compare_wakeup_ticks (const struct list_elem *first_list_elem,
-                           const struct list_elem *second_list_elem,
-                           void *aux UNUSED)
-{
-  struct thread *first_thread = list_entry( first_list_elem, struct thread, time_elem );
-  struct thread *second_thread = list_entry( second_list_elem, struct thread, time_elem );
-
-  if( first_thread->wakeup_ticks < second_thread->wakeup_ticks )
-    return true;
-  else
-  {
-    if( first_thread->wakeup_ticks < second_thread->wakeup_ticks )
-    {
-      return false;
-    }
-    /* if( first_thread->wakeup_ticks == second_thread->wakeup_ticks ) */
-    else
-    {
-      if( first_thread->priority > second_thread->priority )
-      {
-        return true;
-      }
-      else
-        return false;
-    }
-  }
-}
-
-/* list_less_func to compare the priority of the two list elements,
+/* list_less_func to compare the effective priority of the two list elements,
    if first_list_elem has higher priority, returns true
    if first_list_elem has lower or equal priority, returns false
 
@@ -778,7 +970,7 @@ bool compare_priority (const struct list_elem *first_list_elem,
   struct thread *first_thread = list_entry( first_list_elem, struct thread, elem );
   struct thread *second_thread = list_entry( second_list_elem, struct thread, elem );
 
-  if( first_thread->priority > second_thread->priority )
+  if( thread_effective_priority( first_thread ) > thread_effective_priority( second_thread ) )
   {
     return true;
   }
@@ -789,119 +981,214 @@ bool compare_priority (const struct list_elem *first_list_elem,
   }
 }
 
-/* Nested donation of priority handling */
-void thread_donate_priority_chain( struct thread *donating_from, struct thread *donating_to, int donated_priority, int donated_depth )
-{ 
+/* Donates DONOR's priority to LOCK, which DONOR is about to wait
+   for, and on to LOCK's holder.  If the holder is itself waiting
+   for a lock, the donation continues down that chain of locks.
+   Each lock remembers the highest priority among its waiters, so
+   the walk stops as soon as it reaches a lock or a thread that
+   already has at least DONOR's priority.  Interrupts must be
+   off. */
+void
+thread_donate_priority (struct thread *donor, struct lock *lock)
+{
+  int pri = donor->donated_priority;
 
-  enum intr_level old_level;
-  struct thread *high_priority_thread = donating_from;
-  struct thread *low_priority_thread = donating_to;
-  int donation_depth = donated_depth;
+  ASSERT (intr_get_level () == INTR_OFF);
 
-  old_level = intr_disable ();
+  if (lock->max_priority < pri)
+    {
+      lock->max_priority = pri;
+      thread_receive_donation (lock->holder, pri);
+    }
+}
 
-  while(donation_depth < MAX_DONATION_DEPTH && low_priority_thread != NULL)
-  {
-    if( low_priority_thread->donor_list == NULL )
+/* Raises T's donated priority to at least PRI, passing the
+   donation on to whatever lock or reader-writer lock T is itself
+   waiting for.  Does nothing if T is null or already has PRI.
+   Interrupts must be off. */
+void
+thread_receive_donation (struct thread *t, int pri)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (t != NULL && t->donated_priority < pri)
     {
-      list_init(low_priority_thread->donor_list);
+      struct lock *lock = t->waiting_lock;
+
+      t->donated_priority = pri;
+      ready_queue_update (t);
+      if (t->waiting_rwlock != NULL)
+        {
+          rwlock_donate (t->waiting_rwlock, t);
+          break;
+        }
+      if (lock == NULL || lock->max_priority >= pri)
+        break;
+      lock->max_priority = pri;
+      t = lock->holder;
     }
-    
-    if( low_priority_thread->donated_priority < donated_priority )
+}
+
+/* Recomputes T's donated priority as the larger of its base
+   priority and the highest priority waiting on any lock or
+   reader-writer lock it holds.  Takes time proportional to the
+   number of locks T holds.  Interrupts must be off. */
+void
+thread_recompute_priority (struct thread *t)
+{
+  struct list_elem *e;
+  int pri = t->priority;
+  int i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&t->held_locks); e != list_end (&t->held_locks);
+       e = list_next (e))
     {
-      list_insert_ordered(low_priority_thread->donor_list, high_priority_thread->donor_elem, &compare_priority, NULL);
-      high_priority_thread->donated_thread = low_priority_thread;
-      low_priority_thread->donated_priority = donated_priority;
+      struct lock *lock = list_entry (e, struct lock, elem);
+      if (lock->max_priority > pri)
+        pri = lock->max_priority;
     }
-    else 
+  for (e = list_begin (&t->held_rwlocks); e != list_end (&t->held_rwlocks);
+       e = list_next (e))
     {
-      donated_depth = MAX_DONATION_DEPTH;
+      struct rwlock *rw = list_entry (e, struct rwlock, elem);
+      if (rw->max_priority > pri)
+        pri = rw->max_priority;
     }
+  for (i = 0; i < THREAD_READ_LOCKS; i++)
+    {
+      struct rwlock *rw = t->read_locks[i].rwlock;
+      if (rw != NULL && rw->max_priority > pri)
+        pri = rw->max_priority;
+    }
+
+  t->donated_priority = pri;
+  ready_queue_update (t);
+}
 
-    if( low_priority_thread->waiting_lock != NULL )
+/* To check if the current running thread has a greater than or equal priority to the highest priority ready thread.
+   Note: must use function in thread.c, since the ready queues are in thread.c.  Synch.c was not able to access them. */
+void priority_check_running_vs_ready(void)
+{
+  enum intr_level old_level = intr_disable();
+
+  if( ready_queue_highest() > thread_effective_priority( thread_current() ) )
+  {
+    if( intr_context() )
     {
-      high_priority_thread = low_priority_thread;
-      low_priority_thread = (low_priority_thread->waiting_lock)->holder;
+      intr_yield_on_return();
     }
     else
     {
-      donated_depth = MAX_DONATION_DEPTH;
+      thread_yield();
     }
-
-    donation_depth++;
   }
 
   intr_set_level (old_level);
 }
 
-// TODO Fix recall, remove the donated thread down the line? and set the priority to the latest donor, if no donors, then set to standard */
-/* To recall priorities through nested priorities */
-void thread_recall_priority_chain( struct thread *donating_from UNUSED, struct thread *donated_to, int recall_priority UNUSED, int recall_depth UNUSED)
+/* Ends the current MLFQS epoch: recalculates load_avg, records
+   this second's recent_cpu coefficient, and brings RUNNING and
+   every ready thread up to date.  Blocked threads are left alone
+   and caught up by mlfqs_refresh() when they are unblocked, so
+   the work here is bounded by the number of ready threads rather
+   than the number of threads in the system.  Interrupts must be
+   off. */
+static void
+mlfqs_advance_epoch (struct thread *running)
 {
-  // Commented parts to facilitate multi-level donation, currently only single level donation. 
-  enum intr_level old_level;
-  struct thread *high_priority_thread = donating_from;
-  struct thread *low_priority_thread = donated_to;
-  //struct thread *temp_thread;  /* Facilitate cleanup as traveling through donation pathway */ TODO
-  int track_depth = recall_depth;
+  /* load_avg = (59/60)*load_avg + (1/60)*ready_threads */
+  int num_of_running_threads = running != idle_thread ? 1 : 0;
+  int pri;
 
-  old_level = intr_disable ();
+  ASSERT (intr_get_level () == INTR_OFF);
 
-  while( track_depth < MAX_DONATION_DEPTH )
-  {
-    if(!list_empty(low_priority_thread->donor_list))
-    {
-      list_remove(high_priority_thread->donor_elem);
-    }
+  load_avg = add_fp( divide_fp_int( multiply_fp_int(load_avg, 59), 60 ), divide_fp_int( convert_to_fp( ready_cnt + num_of_running_threads ), 60 ) );
 
-    if(list_empty(low_priority_thread->donor_list))
-    {
-      low_priority_thread->donated_priority = low_priority_thread->priority;
-    }
+  mlfqs_record_epoch ();
 
-    if(low_priority_thread->waiting_lock !=  NULL)
-    {
-      high_priority_thread = low_priority_thread;
-      low_priority_thread = (low_priority_thread->waiting_lock)->holder;
-    }
-    else
+  if (running != idle_thread)
+    mlfqs_refresh (running);
+
+  /* A thread whose priority changes moves to another queue and
+     may be visited twice, but the second refresh is a no-op. */
+  for (pri = PRI_MAX; pri >= PRI_MIN; pri--)
     {
-      track_depth = MAX_DONATION_DEPTH;
+      struct list *queue = &ready_queues[pri - PRI_MIN];
+      struct list_elem *e, *next;
+
+      for (e = list_begin (queue); e != list_end (queue); e = next)
+        {
+          struct thread *t = list_entry (e, struct thread, elem);
+          next = list_next (e);
+          mlfqs_refresh (t);
+          ready_queue_update (t);
+        }
     }
-    
-
-    track_depth++;
-  }  
+}
 
+/* Starts a new MLFQS epoch and records the recent_cpu decay
+   coefficient for it, derived from the current load_avg. */
+static void
+mlfqs_record_epoch (void)
+{
+  /* recent_cpu_time = (2 * load_avg) / ((2 * load_avg)+1) * recent_cpu_time + thread_nice  */
+  mlfqs_epoch++;
+  mlfqs_decay[mlfqs_epoch % MLFQS_HISTORY] = divide_fp( multiply_fp_int(load_avg, 2), add_fp_int( multiply_fp_int(load_avg, 2), 1) );
+}
 
-  low_priority_thread->donated_priority = low_priority_thread->priority;
+/* Returns fixed-point X raised to the nonnegative integer power
+   N. */
+static int
+fp_power (int x, int64_t n)
+{
+  int result = convert_to_fp (1);
 
-  intr_set_level (old_level); 
+  while (n > 0)
+    {
+      if (n & 1)
+        result = multiply_fp (result, x);
+      x = multiply_fp (x, x);
+      n >>= 1;
+    }
+  return result;
 }
 
-
-/* To check if the current running thread has a greater than or equal priority to the first thread on the ready queue.
-   Note: must use function in thread.c, since ready_list is in thread.c.  Synch.c was not able to access this queue. */
-void priority_check_running_vs_ready(void)
+/* Applies to T every recent_cpu decay that it has missed since
+   it last ran or was ready, then recalculates its priority.  The
+   caller must requeue T if it is ready.  Interrupts must be off. */
+static void
+mlfqs_refresh (struct thread *t)
 {
-  enum intr_level old_level = intr_disable();
+  int64_t epoch = t->recent_cpu_epoch;
 
-  if( !list_empty(&ready_list) )
-  {
-    if( thread_current()->donated_priority < (list_entry(list_front(&ready_list),struct thread, elem)->donated_priority ) )
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (mlfqs_epoch - epoch > MLFQS_HISTORY)
     {
-      if( intr_context() )
-      {
-        intr_yield_on_return();
-      }
-      else
-      {
-        thread_yield();
-      }
+      /* Epochs older than the history all decay with the oldest
+         coefficient we still have.  With a constant coefficient C,
+         K steps of R = C*R + NICE collapse to
+         R = C^K*R + NICE*(1 - C^K)/(1 - C). */
+      int64_t steps = mlfqs_epoch - MLFQS_HISTORY - epoch;
+      int c = mlfqs_decay[(mlfqs_epoch - MLFQS_HISTORY + 1) % MLFQS_HISTORY];
+      int c_k = fp_power (c, steps);
+      int one = convert_to_fp (1);
+
+      t->recent_cpu_time = add_fp( multiply_fp( c_k, t->recent_cpu_time ),
+                                   divide_fp( multiply_fp_int( subtract_fp( one, c_k ), t->thread_nice ),
+                                              subtract_fp( one, c ) ) );
+      epoch = mlfqs_epoch - MLFQS_HISTORY;
     }
-  }
 
-  intr_set_level (old_level);
+  for (epoch++; epoch <= mlfqs_epoch; epoch++)
+    t->recent_cpu_time = add_fp_int( 
+                         multiply_fp( mlfqs_decay[epoch % MLFQS_HISTORY], t->recent_cpu_time ),
+                         t->thread_nice );
+
+  t->recent_cpu_epoch = mlfqs_epoch;
+  t->priority = calculate_mlfps_priority( t );
 }
 
 /* Calculate new priority for the mlfqs scheduler */
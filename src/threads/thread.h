@@ -2,8 +2,10 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <hash.h>
 #include <list.h>
 #include <stdint.h>
+#include "threads/malloc.h"
 #include "threads/synch.h"
 
 /* States in a thread's life cycle. */
@@ -30,6 +32,10 @@ typedef int tid_t;
 #define NICE_DEFAULT 0                  /* Default niceness */
 #define NICE_MAX 20                     /* Highest niceness */
 
+/* Number of reader-writer locks a thread may hold in shared mode
+   at once. */
+#define THREAD_READ_LOCKS 4
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -102,38 +108,73 @@ struct thread
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
+    struct file *exec_file;             /* Executable, kept open. */
+    struct wait_status *wait_status;    /* This process's completion state. */
+    struct list children;               /* Completion states of children. */
+
+    /* Owned by userprog/syscall.c. */
+    struct list fds;                    /* Open file descriptors. */
+    int next_handle;                    /* Next file descriptor handle. */
+    void *user_esp;                     /* User stack pointer in syscall. */
+
+    /* Owned by userprog/pagedir.c. */
+    int tlb_batch_depth;                /* Nesting of TLB flush batches. */
+    bool tlb_batch_stale;               /* TLB stale since batch began? */
+#endif
+#ifdef VM
+    /* Owned by vm/page.c. */
+    struct hash pages;                  /* Supplemental page table. */
+    void *readahead_next;               /* Page past last fault batch. */
+    size_t readahead_window;            /* Pages to load per fault. */
+
+    /* Owned by vm/mmap.c. */
+    struct list mappings;               /* Memory-mapped files. */
+    int next_mapid;                     /* Next map region identifier. */
 #endif
 
+    /* Owned by threads/malloc.c. */
+    struct malloc_magazine malloc_mags[MALLOC_CLASS_CNT];
+
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
 
     /* Alarm Clock */
-    /* List element for use in timer.c for the timer_sleep() function */
+    /* List element for the timing wheel slot in timer.c */
     struct list_elem time_elem;         /* List element. */
-    /* Semaphore to wakeup the thread in timer.c */
-    struct semaphore sleeping_sema;     /* Semaphore for waking from timer_sleep */
     /* Int value of the number of ticks that will be used to wakup the thread */
     int64_t wakeup_ticks;               /* Absolute time to wakup the thread */
 
     /* Priority Scheduling */
     /* Value to store the donated priority in priority scheduling */
     int donated_priority;               /* Donated priority. */
-    /* Value to check how deep in nested priority the current depth is */
-    int depth_of_donation;              /* Depth of current donation */
     /* Lock this thread is waiting to clear in order to acquire */
     struct lock *waiting_lock;                  /* Lock to wait for */
-    /* Thread this thread donated to */
-    struct thread *donated_thread;       /* Thread donated to */
-    /* List of threads who have donated to this thread */
-    struct list *donor_list;
-    /* element to be placed on donor_list */
-    struct list_elem *donor_elem;
+    /* Locks this thread holds, whose waiters donate to it */
+    struct list held_locks;             /* List of struct lock. */
+    /* Reader-writer lock this thread is waiting to acquire */
+    struct rwlock *waiting_rwlock;      /* Rwlock to wait for */
+    /* Reader-writer locks this thread holds in exclusive mode */
+    struct list held_rwlocks;           /* List of struct rwlock. */
+    /* Reader-writer locks this thread holds in shared mode */
+    struct rwlock_reader read_locks[THREAD_READ_LOCKS];
+    /* Priority of the ready queue this thread is on */
+    int ready_priority;                 /* Valid only when THREAD_READY */
 
     /* Multi-Level Feedback Queue Scheduler */
     /* Thread's nice value */
     int thread_nice;
     /* Thread's recent cpu time */
     int recent_cpu_time;
+    /* MLFQS epoch recent_cpu_time was last decayed up to */
+    int64_t recent_cpu_epoch;
+
+    /* Statistics, in CPU cycles as counted by timer_cycles() */
+    unsigned long long run_cycles;      /* Total time spent running. */
+    unsigned long long run_start;       /* When last dispatched. */
+    unsigned long long ready_start;     /* When unblocked, 0 once dispatched. */
+    unsigned long long schedule_cnt;    /* # of times switched to. */
+    unsigned long long voluntary_cnt;   /* # of switches away on blocking. */
+    unsigned long long involuntary_cnt; /* # of switches away while ready. */
   };
 
 /* If false (default), use round-robin scheduler.
@@ -145,6 +186,7 @@ void thread_init (void);
 void thread_start (void);
 
 void thread_tick (void);
+void thread_skip_ticks (int64_t);
 void thread_print_stats (void);
 
 typedef void thread_func (void *aux);
@@ -173,18 +215,15 @@ int thread_get_recent_cpu (void);
 int thread_get_load_avg (void);
 
 /* Additional methods */
-/* Alarm Clock */
-bool compare_wakeup_ticks (const struct list_elem *first_list_elem,
-                                 const struct list_elem *second_list_elem,
-                                 void *aux);
 /* Priority Scheduler */
 bool compare_priority (const struct list_elem *first_list_elem,
                            const struct list_elem *second_list_elem,
                            void *aux);
 
 /* Priority Donation */
-void thread_donate_priority_chain( struct thread *donating_from, struct thread *donating_to, int donated_priority, int donated_depth );
-void thread_recall_priority_chain( struct thread *donating_from, struct thread *donated_to, int recall_priority, int recall_depth );
+void thread_donate_priority (struct thread *donor, struct lock *lock);
+void thread_receive_donation (struct thread *t, int priority);
+void thread_recompute_priority (struct thread *t);
 void priority_check_running_vs_ready(void);
 /* Multi-level Feedback Queue Scheduler */
 int calculate_mlfps_priority(struct thread *priority_t);
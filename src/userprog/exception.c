@@ -2,8 +2,13 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include "userprog/gdt.h"
+#include "userprog/syscall.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -148,9 +153,23 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
-  /* To implement virtual memory, delete the rest of the function
-     body, and replace it with code that brings in the page to
-     which fault_addr refers. */
+#ifdef VM
+  /* Bring in the page to which fault_addr refers, if it is part
+     of the process's address space but not yet loaded, or grow
+     the stack to cover it.  A fault in kernel mode is taken on
+     behalf of a system call, which saved the user stack
+     pointer. */
+  if (not_present
+      && page_in (fault_addr, user ? f->esp : thread_current ()->user_esp))
+    return;
+#endif
+
+  /* A kernel access to a bad user address from get_user() or
+     put_user() in syscall.c fails the access.  Any other kernel
+     fault is a kernel bug. */
+  if (!user && is_user_vaddr (fault_addr) && syscall_fixup (f))
+    return;
+
   printf ("Page fault at %p: %s error %s page in %s context.\n",
           fault_addr,
           not_present ? "not present" : "rights violation",
@@ -1,13 +1,21 @@
 #include "userprog/pagedir.h"
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
+#include "threads/thread.h"
+
+/* TLB statistics. */
+static long long invlpg_cnt;    /* Single-page invalidations. */
+static long long flush_cnt;     /* Full flushes for invalidation. */
+static long long activate_cnt;  /* Page directory loads. */
 
 static uint32_t *active_pd (void);
-static void invalidate_pagedir (uint32_t *);
+static void invalidate_page (uint32_t *, const void *vpage);
+static void flush_tlb (void);
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -22,11 +30,18 @@ pagedir_create (void)
   return pd;
 }
 
+/* Number of pages pagedir_destroy() frees at a time. */
+#define DESTROY_BATCH 32
+
+static void batch_free_page (void *batch[], size_t *batch_cnt, void *page);
+
 /* Destroys page directory PD, freeing all the pages it
    references. */
 void
 pagedir_destroy (uint32_t *pd) 
 {
+  void *batch[DESTROY_BATCH];
+  size_t batch_cnt = 0;
   uint32_t *pde;
 
   if (pd == NULL)
@@ -36,15 +51,30 @@ pagedir_destroy (uint32_t *pd)
   for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
     if (*pde & PTE_P) 
       {
+        ASSERT (!(*pde & PTE_PS));
         uint32_t *pt = pde_get_pt (*pde);
         uint32_t *pte;
         
         for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
           if (*pte & PTE_P) 
-            palloc_free_page (pte_get_page (*pte));
-        palloc_free_page (pt);
+            batch_free_page (batch, &batch_cnt, pte_get_page (*pte));
+        batch_free_page (batch, &batch_cnt, pt);
       }
-  palloc_free_page (pd);
+  batch_free_page (batch, &batch_cnt, pd);
+  palloc_free_batch (batch, batch_cnt);
+}
+
+/* Adds PAGE to BATCH[], which holds *BATCH_CNT pages to be
+   freed, first freeing the batch if it is full. */
+static void
+batch_free_page (void *batch[], size_t *batch_cnt, void *page) 
+{
+  if (*batch_cnt >= DESTROY_BATCH)
+    {
+      palloc_free_batch (batch, *batch_cnt);
+      *batch_cnt = 0;
+    }
+  batch[(*batch_cnt)++] = page;
 }
 
 /* Returns the address of the page table entry for virtual
@@ -52,7 +82,11 @@ pagedir_destroy (uint32_t *pd)
    If PD does not have a page table for VADDR, behavior depends
    on CREATE.  If CREATE is true, then a new page table is
    created and a pointer into it is returned.  Otherwise, a null
-   pointer is returned. */
+   pointer is returned.
+   If VADDR is in a 4 MB large page, which only kernel virtual
+   addresses can be, returns the address of its page directory
+   entry instead, which has PTE_PS set.  Its P, W, A, and D bits
+   have the same meaning as a PTE's. */
 static uint32_t *
 lookup_page (uint32_t *pd, const void *vaddr, bool create)
 {
@@ -66,6 +100,8 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
   /* Check for a page table for VADDR.
      If one is missing, create one if requested. */
   pde = pd + pd_no (vaddr);
+  if (*pde & PTE_PS)
+    return pde;
   if (*pde == 0) 
     {
       if (create)
@@ -130,10 +166,12 @@ pagedir_get_page (uint32_t *pd, const void *uaddr)
   ASSERT (is_user_vaddr (uaddr));
   
   pte = lookup_page (pd, uaddr, false);
-  if (pte != NULL && (*pte & PTE_P) != 0)
-    return pte_get_page (*pte) + pg_ofs (uaddr);
-  else
+  if (pte == NULL || (*pte & PTE_P) == 0)
     return NULL;
+  else if (*pte & PTE_PS)
+    return pde_get_large_page (*pte) + ((uintptr_t) uaddr & ~PDE_LARGE_ADDR);
+  else
+    return pte_get_page (*pte) + pg_ofs (uaddr);
 }
 
 /* Marks user virtual page UPAGE "not present" in page
@@ -152,7 +190,7 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      invalidate_page (pd, upage);
     }
 }
 
@@ -180,7 +218,7 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
       else 
         {
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -209,7 +247,7 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
       else 
         {
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -221,6 +259,7 @@ pagedir_activate (uint32_t *pd)
 {
   if (pd == NULL)
     pd = init_page_dir;
+  activate_cnt++;
 
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
@@ -243,21 +282,81 @@ active_pd (void)
   return ptov (pd);
 }
 
-/* Seom page table changes can cause the CPU's translation
+/* Begins a batch of page table changes by the current thread,
+   during which the TLB entries that they make stale are not
+   invalidated one by one.  Instead, pagedir_end_batch() flushes
+   the whole TLB once, if any were.  Until then, the current
+   thread may still see the old translations, so a batch suits
+   clearing accessed and dirty bits, not unmapping pages that
+   may be reused right away.  Batches may nest. */
+void
+pagedir_begin_batch (void) 
+{
+  thread_current ()->tlb_batch_depth++;
+}
+
+/* Ends a batch begun by pagedir_begin_batch(), flushing the TLB
+   if the batch left stale entries in it. */
+void
+pagedir_end_batch (void) 
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->tlb_batch_depth > 0);
+  if (--t->tlb_batch_depth == 0 && t->tlb_batch_stale)
+    {
+      t->tlb_batch_stale = false;
+      flush_tlb ();
+    }
+}
+
+/* Prints TLB statistics. */
+void
+pagedir_print_stats (void) 
+{
+  printf ("TLB: %lld page invalidations, %lld full flushes, "
+          "%lld page directory loads\n",
+          invlpg_cnt, flush_cnt, activate_cnt);
+}
+
+/* Some page table changes can cause the CPU's translation
    lookaside buffer (TLB) to become out-of-sync with the page
-   table.  When this happens, we have to "invalidate" the TLB by
-   re-activating it.
+   table.  When this happens, we have to "invalidate" the TLB
+   entry for the page that changed.
 
-   This function invalidates the TLB if PD is the active page
-   directory.  (If PD is not active then its entries are not in
-   the TLB, so there is no need to invalidate anything.) */
+   This function invalidates the TLB entry for VPAGE if PD is
+   the active page directory, or defers it to the end of the
+   current thread's batch, if there is one.  (If PD is not active
+   then its entries are not in the TLB, so there is no need to
+   invalidate anything.) */
 static void
-invalidate_pagedir (uint32_t *pd) 
+invalidate_page (uint32_t *pd, const void *vpage) 
 {
-  if (active_pd () == pd) 
+  struct thread *t;
+
+  if (active_pd () != pd)
+    return;
+
+  t = thread_current ();
+  if (t->tlb_batch_depth > 0)
+    t->tlb_batch_stale = true;
+  else
     {
-      /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
-         "Translation Lookaside Buffers (TLBs)". */
-      pagedir_activate (pd);
-    } 
+      /* See [IA32-v2a] "INVLPG--Invalidate TLB Entry". */
+      asm volatile ("invlpg (%0)" : : "r" (vpage) : "memory");
+      invlpg_cnt++;
+    }
+}
+
+/* Flushes the whole TLB.  Re-activating the active page
+   directory does so.  See [IA32-v3a] 3.12 "Translation
+   Lookaside Buffers (TLBs)". */
+static void
+flush_tlb (void) 
+{
+  uintptr_t pd;
+
+  asm volatile ("movl %%cr3, %0" : "=r" (pd));
+  asm volatile ("movl %0, %%cr3" : : "r" (pd) : "memory");
+  flush_cnt++;
 }
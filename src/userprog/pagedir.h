@@ -14,5 +14,8 @@ void pagedir_set_dirty (uint32_t *pd, const void *upage, bool dirty);
 bool pagedir_is_accessed (uint32_t *pd, const void *upage);
 void pagedir_set_accessed (uint32_t *pd, const void *upage, bool accessed);
 void pagedir_activate (uint32_t *pd);
+void pagedir_begin_batch (void);
+void pagedir_end_batch (void);
+void pagedir_print_stats (void);
 
 #endif /* userprog/pagedir.h */
@@ -7,6 +7,7 @@
 #include <string.h>
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
+#include "userprog/syscall.h"
 #include "userprog/tss.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
@@ -14,43 +15,71 @@
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
 
 static thread_func start_process NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
+static void release_child (struct wait_status *);
 
-/* Starts a new thread running a user program loaded from
-   FILENAME.  The new thread may be scheduled (and may even exit)
-   before process_execute() returns.  Returns the new process's
-   thread id, or TID_ERROR if the thread cannot be created. */
+/* Data shared between process_execute() in the invoking thread
+   and start_process() in the new one. */
+struct exec_info
+  {
+    const char *cmd_line;               /* Program and arguments. */
+    struct semaphore load_done;         /* Upped when loading is done. */
+    struct wait_status *wait_status;    /* The new process's status. */
+    bool success;                       /* Loaded successfully? */
+  };
+
+/* Starts a new thread running a user program loaded from the
+   first word of CMD_LINE, passing it the words of CMD_LINE as
+   its arguments, and waits for it to finish loading.  Returns
+   the new process's thread id, or TID_ERROR if the thread cannot
+   be created or the program cannot be loaded. */
 tid_t
-process_execute (const char *file_name) 
+process_execute (const char *cmd_line) 
 {
-  char *fn_copy;
+  struct exec_info exec;
+  char thread_name[16];
+  char *save_ptr;
   tid_t tid;
 
-  /* Make a copy of FILE_NAME.
-     Otherwise there's a race between the caller and load(). */
-  fn_copy = palloc_get_page (0);
-  if (fn_copy == NULL)
-    return TID_ERROR;
-  strlcpy (fn_copy, file_name, PGSIZE);
-
-  /* Create a new thread to execute FILE_NAME. */
-  tid = thread_create (file_name, PRI_DEFAULT, start_process, fn_copy);
-  if (tid == TID_ERROR)
-    palloc_free_page (fn_copy); 
+  /* CMD_LINE need not be copied, because we wait until load()
+     is done with it. */
+  exec.cmd_line = cmd_line;
+  sema_init (&exec.load_done, 0);
+
+  /* Create a new thread named after the program. */
+  strlcpy (thread_name, cmd_line + strspn (cmd_line, " "),
+           sizeof thread_name);
+  strtok_r (thread_name, " ", &save_ptr);
+  tid = thread_create (thread_name, PRI_DEFAULT, start_process, &exec);
+  if (tid != TID_ERROR)
+    {
+      sema_down (&exec.load_done);
+      if (exec.success)
+        list_push_back (&thread_current ()->children,
+                        &exec.wait_status->elem);
+      else
+        tid = TID_ERROR;
+    }
   return tid;
 }
 
 /* A thread function that loads a user process and starts it
    running. */
 static void
-start_process (void *file_name_)
+start_process (void *exec_)
 {
-  char *file_name = file_name_;
+  struct exec_info *exec = exec_;
+  struct thread *t = thread_current ();
   struct intr_frame if_;
   bool success;
 
@@ -59,10 +88,28 @@ start_process (void *file_name_)
   if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
   if_.cs = SEL_UCSEG;
   if_.eflags = FLAG_IF | FLAG_MBS;
-  success = load (file_name, &if_.eip, &if_.esp);
+  success = load (exec->cmd_line, &if_.eip, &if_.esp);
+
+  /* Set up the status our parent will wait on. */
+  if (success)
+    {
+      struct wait_status *ws = malloc (sizeof *ws);
+      if (ws != NULL)
+        {
+          lock_init (&ws->lock);
+          ws->ref_cnt = 2;
+          ws->tid = t->tid;
+          ws->exit_code = -1;
+          sema_init (&ws->dead, 0);
+          t->wait_status = exec->wait_status = ws;
+        }
+      else
+        success = false;
+    }
 
-  /* If load failed, quit. */
-  palloc_free_page (file_name);
+  /* Tell our parent how it went.  EXEC is gone after this. */
+  exec->success = success;
+  sema_up (&exec->load_done);
   if (!success) 
     thread_exit ();
 
@@ -81,13 +128,28 @@ start_process (void *file_name_)
    exception), returns -1.  If TID is invalid or if it was not a
    child of the calling process, or if process_wait() has already
    been successfully called for the given TID, returns -1
-   immediately, without waiting.
-
-   This function will be implemented in problem 2-2.  For now, it
-   does nothing. */
+   immediately, without waiting. */
 int
-process_wait (tid_t child_tid UNUSED) 
+process_wait (tid_t child_tid) 
 {
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&cur->children); e != list_end (&cur->children);
+       e = list_next (e))
+    {
+      struct wait_status *ws = list_entry (e, struct wait_status, elem);
+      if (ws->tid == child_tid)
+        {
+          int exit_code;
+
+          list_remove (e);
+          sema_down (&ws->dead);
+          exit_code = ws->exit_code;
+          release_child (ws);
+          return exit_code;
+        }
+    }
   return -1;
 }
 
@@ -96,8 +158,25 @@ void
 process_exit (void)
 {
   struct thread *cur = thread_current ();
+  struct list_elem *e, *next;
   uint32_t *pd;
 
+  if (cur->wait_status != NULL)
+    printf ("%s: exit(%d)\n", cur->name, cur->wait_status->exit_code);
+
+  /* Close open files. */
+  syscall_exit ();
+
+#ifdef VM
+  /* Write back memory-mapped files and release the process's
+     frames and swap slots, while its page directory still maps
+     them. */
+  lock_acquire (&fs_lock);
+  mmap_unmap_all ();
+  lock_release (&fs_lock);
+  page_table_destroy ();
+#endif
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
@@ -114,6 +193,40 @@ process_exit (void)
       pagedir_activate (NULL);
       pagedir_destroy (pd);
     }
+
+  /* Close the executable, which had to stay open for as long as
+     its pages might be loaded from it. */
+  lock_acquire (&fs_lock);
+  file_close (cur->exec_file);
+  lock_release (&fs_lock);
+  cur->exec_file = NULL;
+
+  /* Tell our parent we are done, and let go of our children. */
+  if (cur->wait_status != NULL)
+    {
+      sema_up (&cur->wait_status->dead);
+      release_child (cur->wait_status);
+    }
+  for (e = list_begin (&cur->children); e != list_end (&cur->children);
+       e = next)
+    {
+      struct wait_status *ws = list_entry (e, struct wait_status, elem);
+      next = list_remove (e);
+      release_child (ws);
+    }
+}
+
+/* Drops a reference to WS, freeing it if it was the last. */
+static void
+release_child (struct wait_status *ws)
+{
+  int ref_cnt;
+
+  lock_acquire (&ws->lock);
+  ref_cnt = --ws->ref_cnt;
+  lock_release (&ws->lock);
+  if (ref_cnt == 0)
+    free (ws);
 }
 
 /* Sets up the CPU for running user code in the current
@@ -195,39 +308,57 @@ struct Elf32_Phdr
 #define PF_W 2          /* Writable. */
 #define PF_R 4          /* Readable. */
 
-static bool setup_stack (void **esp);
+static bool setup_stack (const char *cmd_line, void **esp);
 static bool validate_segment (const struct Elf32_Phdr *, struct file *);
 static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
                           uint32_t read_bytes, uint32_t zero_bytes,
                           bool writable);
 
-/* Loads an ELF executable from FILE_NAME into the current thread.
-   Stores the executable's entry point into *EIP
-   and its initial stack pointer into *ESP.
+/* Loads an ELF executable named by the first word of CMD_LINE
+   into the current thread.  Stores the executable's entry point
+   into *EIP and its initial stack pointer, with the words of
+   CMD_LINE pushed as arguments, into *ESP.
    Returns true if successful, false otherwise. */
 bool
-load (const char *file_name, void (**eip) (void), void **esp) 
+load (const char *cmd_line, void (**eip) (void), void **esp) 
 {
   struct thread *t = thread_current ();
+  char file_name[NAME_MAX + 2];
   struct Elf32_Ehdr ehdr;
   struct file *file = NULL;
   off_t file_ofs;
   bool success = false;
+  size_t name_len;
   int i;
 
+  /* Extract the program name.  One that is too long to be a file
+     name is truncated to one that is also too long. */
+  while (*cmd_line == ' ')
+    cmd_line++;
+  name_len = strcspn (cmd_line, " ");
+  strlcpy (file_name, cmd_line,
+           name_len < sizeof file_name ? name_len + 1 : sizeof file_name);
+
   /* Allocate and activate page directory. */
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL) 
     goto done;
   process_activate ();
+#ifdef VM
+  if (!page_table_init ())
+    goto done;
+#endif
 
   /* Open executable file. */
+  lock_acquire (&fs_lock);
   file = filesys_open (file_name);
   if (file == NULL) 
     {
       printf ("load: %s: open failed\n", file_name);
       goto done; 
     }
+  t->exec_file = file;
+  file_deny_write (file);
 
   /* Read and verify executable header. */
   if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
@@ -301,8 +432,10 @@ load (const char *file_name, void (**eip) (void), void **esp)
         }
     }
 
+  lock_release (&fs_lock);
+
   /* Set up stack. */
-  if (!setup_stack (esp))
+  if (!setup_stack (cmd_line, esp))
     goto done;
 
   /* Start address. */
@@ -311,14 +444,18 @@ load (const char *file_name, void (**eip) (void), void **esp)
   success = true;
 
  done:
-  /* We arrive here whether the load is successful or not. */
-  file_close (file);
+  /* We arrive here whether the load is successful or not.  The
+     executable is closed by process_exit(). */
+  if (lock_held_by_current_thread (&fs_lock))
+    lock_release (&fs_lock);
   return success;
 }
 
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -377,6 +514,10 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   With virtual memory, the pages are only entered in the
+   supplemental page table here, and page_in() loads each one
+   when it is first accessed.
+
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
 static bool
@@ -396,6 +537,16 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
+#ifdef VM
+      /* Record where to find this page. */
+      struct page *p = (page_read_bytes > 0
+                        ? page_add_file (upage, file, ofs, page_read_bytes,
+                                         writable)
+                        : page_add_zero (upage, writable));
+      if (p == NULL)
+        return false;
+      ofs += page_read_bytes;
+#else
       /* Get a page of memory. */
       uint8_t *kpage = palloc_get_page (PAL_USER);
       if (kpage == NULL)
@@ -415,6 +566,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
           palloc_free_page (kpage);
           return false; 
         }
+#endif
 
       /* Advance. */
       read_bytes -= page_read_bytes;
@@ -424,26 +576,94 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   return true;
 }
 
+/* Pushes the SIZE bytes in BUF onto the user stack whose top is
+   *ESP, padded to a multiple of 4 bytes, and returns the user
+   address of the copy.  Returns a null pointer if the copy would
+   overflow the stack's first page. */
+static void *
+push (void **esp, const void *buf, size_t size)
+{
+  size_t padsize = ROUND_UP (size, sizeof (uint32_t));
+  uint8_t *top = *esp;
+
+  if ((size_t) (top - ((uint8_t *) PHYS_BASE - PGSIZE)) < padsize)
+    return NULL;
+  top -= padsize;
+  memcpy (top + (padsize - size), buf, size);
+  *esp = top;
+  return top + (padsize - size);
+}
+
+/* Pushes the words of CMD_LINE onto the user stack whose top is
+   *ESP, laid out as the arguments to main(), and a null return
+   address.  The current process's page directory must be
+   active.  Returns true if successful, false if they do not fit
+   in a page. */
+static bool
+push_args (const char *cmd_line, void **esp)
+{
+  static void *const null = NULL;
+  char *copy, *arg, *save_ptr;
+  char **argv;
+  int argc;
+  int i;
+
+  /* Push the command line itself, then argv[argc]. */
+  copy = push (esp, cmd_line, strlen (cmd_line) + 1);
+  if (copy == NULL || push (esp, &null, sizeof null) == NULL)
+    return false;
+
+  /* Split the copy into words in place, pushing a pointer to
+     each, which puts them in reverse order. */
+  argc = 0;
+  for (arg = strtok_r (copy, " ", &save_ptr); arg != NULL;
+       arg = strtok_r (NULL, " ", &save_ptr))
+    {
+      if (push (esp, &arg, sizeof arg) == NULL)
+        return false;
+      argc++;
+    }
+  argv = *esp;
+  for (i = 0; i < argc / 2; i++)
+    {
+      char *tmp = argv[i];
+      argv[i] = argv[argc - 1 - i];
+      argv[argc - 1 - i] = tmp;
+    }
+
+  /* Push argv, argc, and a return address. */
+  return (push (esp, &argv, sizeof argv) != NULL
+          && push (esp, &argc, sizeof argc) != NULL
+          && push (esp, &null, sizeof null) != NULL);
+}
+
 /* Create a minimal stack by mapping a zeroed page at the top of
-   user virtual memory. */
+   user virtual memory, and push the arguments in CMD_LINE. */
 static bool
-setup_stack (void **esp) 
+setup_stack (const char *cmd_line, void **esp) 
 {
+#ifdef VM
+  /* Enter the page in the supplemental page table, so that it
+     gets a frame when push_args() first touches it. */
+  if (page_add_zero (((uint8_t *) PHYS_BASE) - PGSIZE, true) == NULL)
+    return false;
+#else
   uint8_t *kpage;
-  bool success = false;
 
   kpage = palloc_get_page (PAL_USER | PAL_ZERO);
-  if (kpage != NULL) 
+  if (kpage == NULL)
+    return false;
+  if (!install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true))
     {
-      success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
-      if (success)
-        *esp = PHYS_BASE;
-      else
-        palloc_free_page (kpage);
+      palloc_free_page (kpage);
+      return false;
     }
-  return success;
+#endif
+  *esp = PHYS_BASE;
+  return push_args (cmd_line, esp);
 }
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -463,3 +683,4 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
@@ -1,8 +1,22 @@
 #ifndef USERPROG_PROCESS_H
 #define USERPROG_PROCESS_H
 
+#include "threads/synch.h"
 #include "threads/thread.h"
 
+/* Tracks the completion of a process.  Shared between the
+   process and its parent, in the parent's `children' list, and
+   freed by whichever of the two lets go of it last. */
+struct wait_status
+  {
+    struct list_elem elem;      /* Element in parent's `children'. */
+    struct lock lock;           /* Protects ref_cnt. */
+    int ref_cnt;                /* 2=child and parent alive, 1=either. */
+    tid_t tid;                  /* Child thread id. */
+    int exit_code;              /* Child exit code, once dead. */
+    struct semaphore dead;      /* Upped when the child dies. */
+  };
+
 tid_t process_execute (const char *file_name);
 int process_wait (tid_t);
 void process_exit (void);
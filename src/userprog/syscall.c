@@ -1,20 +1,639 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include "devices/input.h"
+#include "devices/shutdown.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/process.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
+
+/* System calls.
+
+   The system call number and its arguments are on the user
+   stack.  Each is copied in with get_user(), which lets the page
+   fault handler catch a bad address instead of checking it in
+   advance: a fault that page_in() cannot resolve resumes
+   get_user() with a failure indication, and the process is
+   terminated.  Buffers passed to read and write are checked the
+   same way, by touching one byte in each page they span, so that
+   checking a buffer costs one access per page, not per byte.
+   The file system then reads into and writes from the user
+   buffer itself, without copying it through the kernel.  To
+   keep a page fault from occurring while fs_lock is held, the
+   pages of each piece of the buffer handed to the file system
+   are first pinned in memory with pin_user(). */
+
+/* Serializes file system operations. */
+struct lock fs_lock;
+
+/* A file descriptor, in a process's `fds' list. */
+struct file_descriptor
+  {
+    struct list_elem elem;      /* Element in thread's `fds'. */
+    struct file *file;          /* Open file. */
+    int handle;                 /* Handle returned to the process. */
+  };
+
+/* A system call implementation.  ARGS holds the call's
+   arguments, as copied from the user stack. */
+typedef int syscall_function (const uint32_t args[]);
+
+static syscall_function sys_halt, sys_exit, sys_exec, sys_wait;
+static syscall_function sys_create, sys_remove, sys_open, sys_filesize;
+static syscall_function sys_read, sys_write, sys_seek, sys_tell;
+static syscall_function sys_close;
+#ifdef VM
+static syscall_function sys_mmap, sys_munmap;
+#endif
+
+/* A system call. */
+struct syscall
+  {
+    size_t arg_cnt;             /* Number of arguments. */
+    syscall_function *func;     /* Implementation. */
+  };
+
+/* Table of system calls, indexed by number.  Calls that are not
+   implemented have a null FUNC. */
+static const struct syscall syscall_table[] =
+  {
+    [SYS_HALT] = {0, sys_halt},
+    [SYS_EXIT] = {1, sys_exit},
+    [SYS_EXEC] = {1, sys_exec},
+    [SYS_WAIT] = {1, sys_wait},
+    [SYS_CREATE] = {2, sys_create},
+    [SYS_REMOVE] = {1, sys_remove},
+    [SYS_OPEN] = {1, sys_open},
+    [SYS_FILESIZE] = {1, sys_filesize},
+    [SYS_READ] = {3, sys_read},
+    [SYS_WRITE] = {3, sys_write},
+    [SYS_SEEK] = {2, sys_seek},
+    [SYS_TELL] = {1, sys_tell},
+    [SYS_CLOSE] = {1, sys_close},
+#ifdef VM
+    [SYS_MMAP] = {2, sys_mmap},
+    [SYS_MUNMAP] = {1, sys_munmap},
+#endif
+  };
+
+/* Most arguments any system call takes. */
+#define SYSCALL_MAX_ARGS 3
+
+/* Most bytes that read and write pin and transfer at once. */
+#define XFER_MAX (16 * PGSIZE)
+
+/* An instruction that accesses user memory, and the address to
+   resume at, with -1 in EAX, if it faults.  get_user() and
+   put_user() record one of these in the user_fixups section for
+   each of their accesses, which the kernel's linker script
+   gathers between _start_user_fixups and _end_user_fixups. */
+struct user_fixup
+  {
+    uintptr_t insn;             /* Faulting instruction. */
+    uintptr_t resume;           /* Where to resume. */
+  };
+
+extern const struct user_fixup _start_user_fixups[], _end_user_fixups[];
+
+/* Emits a user_fixup for the instruction at local label 1 that
+   resumes at local label 2. */
+#define USER_FIXUP                              \
+  ".pushsection user_fixups, \"a\"\n"           \
+  ".long 1b, 2b\n"                              \
+  ".popsection\n"
 
 static void syscall_handler (struct intr_frame *);
+static void terminate (void) NO_RETURN;
+static inline int get_user (const uint8_t *uaddr);
+static inline bool put_user (uint8_t *udst, uint8_t byte);
+static void copy_in (void *dst, const void *usrc, size_t size);
+static char *copy_in_string (const char *us);
+static void verify_user (const void *uaddr, size_t size, bool writable);
+static void pin_user (const void *uaddr, size_t size, bool will_write);
+static void unpin_user (const void *uaddr, size_t size);
+static struct file_descriptor *lookup_fd (int handle);
 
 void
-syscall_init (void) 
+syscall_init (void)
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
+  lock_init (&fs_lock);
+}
+
+/* Closes the current process's open files, as it exits. */
+void
+syscall_exit (void)
+{
+  struct thread *cur = thread_current ();
+
+  while (!list_empty (&cur->fds))
+    {
+      struct file_descriptor *fd
+        = list_entry (list_pop_front (&cur->fds),
+                      struct file_descriptor, elem);
+      lock_acquire (&fs_lock);
+      file_close (fd->file);
+      lock_release (&fs_lock);
+      free (fd);
+    }
+}
+
+/* Called by the page fault handler for a kernel page fault on a
+   user address that could not be resolved.  If the fault came
+   from get_user() or put_user(), arranges for F to resume after
+   the faulting access with -1 in EAX and returns true.
+   Otherwise, returns false. */
+bool
+syscall_fixup (struct intr_frame *f)
+{
+  const struct user_fixup *fx;
+
+  for (fx = _start_user_fixups; fx < _end_user_fixups; fx++)
+    if (fx->insn == (uintptr_t) f->eip)
+      {
+        f->eip = (void (*) (void)) fx->resume;
+        f->eax = 0xffffffff;
+        return true;
+      }
+  return false;
+}
+
+/* Dispatches the system call whose number and arguments are on
+   the user stack that F points to, and stores its return value
+   in F's EAX. */
+static void
+syscall_handler (struct intr_frame *f)
+{
+  const struct syscall *sc;
+  uint32_t args[SYSCALL_MAX_ARGS];
+  unsigned call_nr;
+
+  /* Saved so that a page fault taken on the process's behalf
+     can tell whether it is growing the stack. */
+  thread_current ()->user_esp = f->esp;
+
+  copy_in (&call_nr, f->esp, sizeof call_nr);
+  if (call_nr >= sizeof syscall_table / sizeof *syscall_table
+      || syscall_table[call_nr].func == NULL)
+    terminate ();
+  sc = &syscall_table[call_nr];
+
+  ASSERT (sc->arg_cnt <= SYSCALL_MAX_ARGS);
+  memset (args, 0, sizeof args);
+  copy_in (args, (uint32_t *) f->esp + 1, sizeof *args * sc->arg_cnt);
+  f->eax = sc->func (args);
+}
+
+/* Halt system call. */
+static int
+sys_halt (const uint32_t args[] UNUSED)
+{
+  shutdown_power_off ();
+}
+
+/* Exit system call. */
+static int
+sys_exit (const uint32_t args[])
+{
+  int status = args[0];
+
+  thread_current ()->wait_status->exit_code = status;
+  thread_exit ();
+}
+
+/* Exec system call. */
+static int
+sys_exec (const uint32_t args[])
+{
+  char *cmd_line = copy_in_string ((const char *) args[0]);
+  tid_t tid;
+
+  tid = process_execute (cmd_line);
+  palloc_free_page (cmd_line);
+  return tid;
+}
+
+/* Wait system call. */
+static int
+sys_wait (const uint32_t args[])
+{
+  tid_t child = args[0];
+
+  return process_wait (child);
+}
+
+/* Create system call. */
+static int
+sys_create (const uint32_t args[])
+{
+  char *name = copy_in_string ((const char *) args[0]);
+  unsigned initial_size = args[1];
+  bool ok;
+
+  lock_acquire (&fs_lock);
+  ok = filesys_create (name, initial_size);
+  lock_release (&fs_lock);
+  palloc_free_page (name);
+  return ok;
+}
+
+/* Remove system call. */
+static int
+sys_remove (const uint32_t args[])
+{
+  char *name = copy_in_string ((const char *) args[0]);
+  bool ok;
+
+  lock_acquire (&fs_lock);
+  ok = filesys_remove (name);
+  lock_release (&fs_lock);
+  palloc_free_page (name);
+  return ok;
+}
+
+/* Open system call. */
+static int
+sys_open (const uint32_t args[])
+{
+  struct thread *cur = thread_current ();
+  char *name = copy_in_string ((const char *) args[0]);
+  struct file_descriptor *fd;
+  int handle = -1;
+
+  fd = malloc (sizeof *fd);
+  if (fd != NULL)
+    {
+      lock_acquire (&fs_lock);
+      fd->file = filesys_open (name);
+      lock_release (&fs_lock);
+      if (fd->file != NULL)
+        {
+          handle = fd->handle = cur->next_handle++;
+          list_push_front (&cur->fds, &fd->elem);
+        }
+      else
+        free (fd);
+    }
+  palloc_free_page (name);
+  return handle;
+}
+
+/* Filesize system call. */
+static int
+sys_filesize (const uint32_t args[])
+{
+  struct file_descriptor *fd = lookup_fd (args[0]);
+  int size;
+
+  lock_acquire (&fs_lock);
+  size = file_length (fd->file);
+  lock_release (&fs_lock);
+  return size;
+}
+
+/* Read system call. */
+static int
+sys_read (const uint32_t args[])
+{
+  int handle = args[0];
+  uint8_t *udst = (uint8_t *) args[1];
+  unsigned size = args[2];
+  struct file_descriptor *fd;
+  int bytes_read = 0;
+
+  verify_user (udst, size, true);
+  if (handle == STDIN_FILENO)
+    {
+      /* The buffer's pages may be evicted while we wait for
+         input, so store each byte with put_user(). */
+      for (; bytes_read < (int) size; bytes_read++)
+        if (!put_user (udst + bytes_read, input_getc ()))
+          terminate ();
+      return bytes_read;
+    }
+
+  fd = lookup_fd (handle);
+  while (size > 0)
+    {
+      size_t chunk = size < XFER_MAX ? size : XFER_MAX;
+      off_t retval;
+
+      pin_user (udst + bytes_read, chunk, true);
+      lock_acquire (&fs_lock);
+      retval = file_read (fd->file, udst + bytes_read, chunk);
+      lock_release (&fs_lock);
+      unpin_user (udst + bytes_read, chunk);
+      if (retval < 0)
+        {
+          if (bytes_read == 0)
+            bytes_read = -1;
+          break;
+        }
+      bytes_read += retval;
+      if (retval != (off_t) chunk)
+        break;
+      size -= retval;
+    }
+  return bytes_read;
 }
 
+/* Write system call. */
+static int
+sys_write (const uint32_t args[])
+{
+  int handle = args[0];
+  const uint8_t *usrc = (const uint8_t *) args[1];
+  unsigned size = args[2];
+  struct file_descriptor *fd = NULL;
+  int bytes_written = 0;
+
+  verify_user (usrc, size, false);
+  if (handle != STDOUT_FILENO)
+    fd = lookup_fd (handle);
+
+  while (size > 0)
+    {
+      size_t chunk = size < XFER_MAX ? size : XFER_MAX;
+      const uint8_t *p = usrc + bytes_written;
+      off_t retval;
+
+      /* Pinned for the console too, which holds its own lock. */
+      pin_user (p, chunk, false);
+      if (fd == NULL)
+        {
+          putbuf ((const char *) p, chunk);
+          retval = chunk;
+        }
+      else
+        {
+          lock_acquire (&fs_lock);
+          retval = file_write (fd->file, p, chunk);
+          lock_release (&fs_lock);
+        }
+      unpin_user (p, chunk);
+      if (retval < 0)
+        {
+          if (bytes_written == 0)
+            bytes_written = -1;
+          break;
+        }
+      bytes_written += retval;
+      if (retval != (off_t) chunk)
+        break;
+      size -= retval;
+    }
+  return bytes_written;
+}
+
+/* Seek system call. */
+static int
+sys_seek (const uint32_t args[])
+{
+  struct file_descriptor *fd = lookup_fd (args[0]);
+  unsigned position = args[1];
+
+  lock_acquire (&fs_lock);
+  if ((off_t) position >= 0)
+    file_seek (fd->file, position);
+  lock_release (&fs_lock);
+  return 0;
+}
+
+/* Tell system call. */
+static int
+sys_tell (const uint32_t args[])
+{
+  struct file_descriptor *fd = lookup_fd (args[0]);
+  unsigned position;
+
+  lock_acquire (&fs_lock);
+  position = file_tell (fd->file);
+  lock_release (&fs_lock);
+  return position;
+}
+
+/* Close system call. */
+static int
+sys_close (const uint32_t args[])
+{
+  struct file_descriptor *fd = lookup_fd (args[0]);
+
+  lock_acquire (&fs_lock);
+  file_close (fd->file);
+  lock_release (&fs_lock);
+  list_remove (&fd->elem);
+  free (fd);
+  return 0;
+}
+
+#ifdef VM
+/* Mmap system call. */
+static int
+sys_mmap (const uint32_t args[])
+{
+  struct file_descriptor *fd = lookup_fd (args[0]);
+  void *addr = (void *) args[1];
+  mapid_t mapping;
+
+  lock_acquire (&fs_lock);
+  mapping = mmap_map (fd->file, addr);
+  lock_release (&fs_lock);
+  return mapping;
+}
+
+/* Munmap system call. */
+static int
+sys_munmap (const uint32_t args[])
+{
+  mapid_t mapping = args[0];
+
+  lock_acquire (&fs_lock);
+  mmap_unmap (mapping);
+  lock_release (&fs_lock);
+  return 0;
+}
+#endif
+
+/* Terminates the current process with exit code -1, for passing
+   a bad argument to a system call. */
 static void
-syscall_handler (struct intr_frame *f UNUSED) 
+terminate (void)
 {
-  printf ("system call!\n");
   thread_exit ();
 }
+
+/* Reads a byte at user virtual address UADDR.
+   Returns the byte value if successful, -1 if UADDR is not a
+   valid user address or a page fault occurred. */
+static inline int
+get_user (const uint8_t *uaddr)
+{
+  int result;
+
+  if (!is_user_vaddr (uaddr))
+    return -1;
+  asm volatile ("1: movzbl %1, %0\n2:\n" USER_FIXUP
+                : "=a" (result) : "m" (*uaddr));
+  return result;
+}
+
+/* Writes BYTE to user address UDST.
+   Returns true if successful, false if UDST is not a valid user
+   address or a page fault occurred. */
+static inline bool
+put_user (uint8_t *udst, uint8_t byte)
+{
+  int error_code;
+
+  if (!is_user_vaddr (udst))
+    return false;
+  asm volatile ("1: movb %b2, %1\n2:\n" USER_FIXUP
+                : "=a" (error_code), "=m" (*udst) : "q" (byte), "0" (0));
+  return error_code != -1;
+}
+
+/* Copies SIZE bytes from user address USRC to kernel address
+   DST.  Terminates the process if any of the user accesses are
+   invalid. */
+static void
+copy_in (void *dst_, const void *usrc_, size_t size)
+{
+  uint8_t *dst = dst_;
+  const uint8_t *usrc = usrc_;
+
+  for (; size > 0; size--, dst++, usrc++)
+    {
+      int byte = get_user (usrc);
+      if (byte < 0)
+        terminate ();
+      *dst = byte;
+    }
+}
+
+/* Creates a copy of user string US in kernel memory and returns
+   it as a page that must be freed with palloc_free_page().
+   Truncates the string at PGSIZE bytes in size.  Terminates the
+   process if any of the user accesses are invalid, or exits it
+   if no page can be allocated. */
+static char *
+copy_in_string (const char *us)
+{
+  char *ks;
+  size_t length;
+
+  ks = palloc_get_page (0);
+  if (ks == NULL)
+    thread_exit ();
+  for (length = 0; length < PGSIZE; length++)
+    {
+      int c = get_user ((const uint8_t *) us + length);
+      if (c < 0)
+        {
+          palloc_free_page (ks);
+          terminate ();
+        }
+      ks[length] = c;
+      if (c == '\0')
+        return ks;
+    }
+  ks[PGSIZE - 1] = '\0';
+  return ks;
+}
+
+/* Verifies that the SIZE bytes at user address UADDR can be
+   read by the kernel, and written too if WRITABLE is true, by
+   touching one byte in each page they span.  Terminates the
+   process if they cannot.  Writing rewrites the byte that was
+   read. */
+static void
+verify_user (const void *uaddr, size_t size, bool writable)
+{
+  const uint8_t *p = uaddr;
+  const uint8_t *last;
+
+  if (size == 0)
+    return;
+  last = p + size - 1;
+  if (last < p)
+    terminate ();
+
+  for (;;)
+    {
+      int byte = get_user (p);
+      if (byte < 0 || (writable && !put_user ((uint8_t *) p, byte)))
+        terminate ();
+      if (pg_no (p) == pg_no (last))
+        break;
+      p = (const uint8_t *) pg_round_down (p) + PGSIZE;
+    }
+}
+
+/* Pins the SIZE bytes of user memory starting at UADDR, which
+   must have passed verify_user(), in memory so that the kernel
+   can access them without a page fault.  If WILL_WRITE is true,
+   they must be writable.  Terminates the process if a page
+   cannot be pinned.  Must be balanced by unpin_user().
+
+   Without virtual memory, every page of a process is resident
+   for its whole life, so there is nothing to do. */
+static void
+pin_user (const void *uaddr UNUSED, size_t size UNUSED,
+          bool will_write UNUSED)
+{
+#ifdef VM
+  const uint8_t *p = pg_round_down (uaddr);
+  const uint8_t *end = (const uint8_t *) uaddr + size;
+
+  for (; p < end; p += PGSIZE)
+    if (!page_lock (p, will_write))
+      {
+        const uint8_t *first = pg_round_down (uaddr);
+
+        unpin_user (first, p - first);
+        terminate ();
+      }
+#endif
+}
+
+/* Unpins the SIZE bytes of user memory starting at UADDR, which
+   were pinned by pin_user(). */
+static void
+unpin_user (const void *uaddr UNUSED, size_t size UNUSED)
+{
+#ifdef VM
+  const uint8_t *p = pg_round_down (uaddr);
+  const uint8_t *end = (const uint8_t *) uaddr + size;
+
+  for (; p < end; p += PGSIZE)
+    page_unlock (p);
+#endif
+}
+
+/* Returns the current process's file descriptor for HANDLE.
+   Terminates the process if there is none. */
+static struct file_descriptor *
+lookup_fd (int handle)
+{
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&cur->fds); e != list_end (&cur->fds);
+       e = list_next (e))
+    {
+      struct file_descriptor *fd
+        = list_entry (e, struct file_descriptor, elem);
+      if (fd->handle == handle)
+        return fd;
+    }
+  terminate ();
+}
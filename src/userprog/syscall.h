@@ -1,6 +1,17 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include <stdbool.h>
+#include "threads/synch.h"
+
+struct intr_frame;
+
+/* Serializes file system operations, which are not otherwise
+   safe to run concurrently. */
+extern struct lock fs_lock;
+
 void syscall_init (void);
+void syscall_exit (void);
+bool syscall_fixup (struct intr_frame *);
 
 #endif /* userprog/syscall.h */
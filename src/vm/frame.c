@@ -0,0 +1,385 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+
+/* Frame table.
+
+   Every user page that is in memory occupies a frame obtained
+   from the user pool with palloc_get_page(PAL_USER).  The frames
+   in use form a circular list, swept by the "hand" of a
+   second-chance clock: when the user pool runs dry, the hand
+   advances past frames whose page has been accessed since the
+   last sweep, clearing their accessed bits, and the first frame
+   that has not been accessed is evicted and reused.  Frames
+   released by exiting processes go back to the user pool, and
+   their struct frame to a list of unused ones.
+
+   Read-only pages of executables are shared: the share table
+   maps a file page to the frame that holds it, and a process
+   that faults on such a page adds itself to that frame instead
+   of reading the page again.  The frame is freed when the last
+   process using it releases it, or evicted from all of them at
+   once. */
+
+/* Frames holding pages, in clock order. */
+static struct list frames;
+
+/* Clock hand: the next frame in `frames' to examine. */
+static struct list_elem *hand;
+
+/* Struct frames with no page frame, for reuse. */
+static struct list unused_frames;
+
+/* Number of elements in `frames'. */
+static size_t frame_cnt;
+
+/* Protects the lists above and the clock hand. */
+static struct lock scan_lock;
+
+/* Shared frames, keyed on file page.  A frame's lock must be
+   held to add it to or remove it from the table. */
+static struct hash share_table;
+
+/* Protects share_table.  May be acquired while holding a frame's
+   lock, but not vice versa. */
+static struct lock share_lock;
+
+/* Allocator for struct frame. */
+static struct kmem_cache frame_cache;
+
+static struct frame *clock_evict_and_lock (void);
+static bool frame_accessed_recently (struct frame *);
+static bool frame_evict (struct frame *);
+static void frame_unshare (struct frame *);
+static hash_hash_func share_hash;
+static hash_less_func share_less;
+
+/* Initializes the frame table. */
+void
+frame_init (void)
+{
+  list_init (&frames);
+  list_init (&unused_frames);
+  hand = list_end (&frames);
+  frame_cnt = 0;
+  lock_init (&scan_lock);
+  if (!hash_init (&share_table, share_hash, share_less, NULL))
+    PANIC ("frame: share table creation failed");
+  lock_init (&share_lock);
+  kmem_cache_init (&frame_cache, "frame", sizeof (struct frame), NULL);
+}
+
+/* Obtains a frame for page P, evicting other pages if the user
+   pool has none to spare, and returns it with its lock held.
+   Returns a null pointer if no frame can be obtained. */
+struct frame *
+frame_alloc_and_lock (struct page *p)
+{
+  struct frame *f;
+
+  f = frame_try_alloc_and_lock (p);
+  if (f != NULL)
+    return f;
+
+  /* Out of memory: evict a page. */
+  lock_acquire (&scan_lock);
+  f = clock_evict_and_lock ();
+  lock_release (&scan_lock);
+  if (f == NULL)
+    return NULL;
+  if (!frame_evict (f))
+    {
+      lock_release (&f->lock);
+      return NULL;
+    }
+  list_push_back (&f->pages, &p->frame_elem);
+  return f;
+}
+
+/* Obtains a free frame for page P from the user pool, without
+   evicting any page, and returns it with its lock held.  Returns
+   a null pointer if the user pool is empty. */
+struct frame *
+frame_try_alloc_and_lock (struct page *p)
+{
+  struct frame *f = NULL;
+  void *kpage;
+
+  kpage = palloc_get_page (PAL_USER);
+  if (kpage == NULL)
+    return NULL;
+
+  lock_acquire (&scan_lock);
+  if (!list_empty (&unused_frames))
+    f = list_entry (list_pop_front (&unused_frames), struct frame, elem);
+  else
+    {
+      f = kmem_cache_alloc (&frame_cache);
+      if (f != NULL)
+        lock_init (&f->lock);
+    }
+  if (f != NULL)
+    {
+      lock_acquire (&f->lock);
+      f->kpage = kpage;
+      list_init (&f->pages);
+      list_push_back (&f->pages, &p->frame_elem);
+      f->inode = NULL;
+      list_insert (hand, &f->elem);
+      frame_cnt++;
+    }
+  lock_release (&scan_lock);
+
+  if (f == NULL)
+    palloc_free_page (kpage);
+  return f;
+}
+
+/* Looks up the shared frame that holds the READ_BYTES bytes at
+   offset OFS in INODE.  If there is one, adds page P to it and
+   returns it with its lock held.  Otherwise, returns a null
+   pointer. */
+struct frame *
+frame_share_lock (struct page *p, struct inode *inode, off_t ofs,
+                  size_t read_bytes)
+{
+  for (;;)
+    {
+      struct frame key, *f;
+      struct hash_elem *e;
+
+      key.inode = inode;
+      key.ofs = ofs;
+      key.read_bytes = read_bytes;
+      lock_acquire (&share_lock);
+      e = hash_find (&share_table, &key.share_elem);
+      f = e != NULL ? hash_entry (e, struct frame, share_elem) : NULL;
+      lock_release (&share_lock);
+      if (f == NULL)
+        return NULL;
+
+      /* The frame may have been evicted or freed before we got
+         its lock.  If so, look again. */
+      lock_acquire (&f->lock);
+      if (f->inode == inode && f->ofs == ofs && f->read_bytes == read_bytes)
+        {
+          list_push_back (&f->pages, &p->frame_elem);
+          return f;
+        }
+      lock_release (&f->lock);
+    }
+}
+
+/* Returns true if a frame in the share table holds the
+   READ_BYTES bytes at offset OFS in INODE, false otherwise.  The
+   answer may be out of date by the time the caller sees it. */
+bool
+frame_is_shared (struct inode *inode, off_t ofs, size_t read_bytes)
+{
+  struct frame key;
+  bool shared;
+
+  key.inode = inode;
+  key.ofs = ofs;
+  key.read_bytes = read_bytes;
+  lock_acquire (&share_lock);
+  shared = hash_find (&share_table, &key.share_elem) != NULL;
+  lock_release (&share_lock);
+  return shared;
+}
+
+/* Enters frame F, which the current thread must have locked and
+   which holds the READ_BYTES bytes at offset OFS in INODE, in
+   the share table, so that other processes can map it too.  Does
+   nothing if another frame already holds that page. */
+void
+frame_share (struct frame *f, struct inode *inode, off_t ofs,
+             size_t read_bytes)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+  ASSERT (f->inode == NULL);
+
+  f->inode = inode;
+  f->ofs = ofs;
+  f->read_bytes = read_bytes;
+  lock_acquire (&share_lock);
+  if (hash_insert (&share_table, &f->share_elem) != NULL)
+    f->inode = NULL;
+  lock_release (&share_lock);
+}
+
+/* Locks P's frame, if it has one, pinning it in memory.  On
+   return, either P->frame is locked by the current thread or P
+   is not in a frame.  P must belong to the current thread, so
+   that it cannot be freed meanwhile. */
+void
+frame_lock (struct page *p)
+{
+  struct frame *f = p->frame;
+
+  if (f != NULL)
+    {
+      lock_acquire (&f->lock);
+      if (f != p->frame)
+        {
+          /* Evicted while we waited. */
+          lock_release (&f->lock);
+          ASSERT (p->frame == NULL);
+        }
+    }
+}
+
+/* Unlocks frame F, allowing it to be evicted. */
+void
+frame_unlock (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+  lock_release (&f->lock);
+}
+
+/* Removes page P from frame F, which must be locked by the
+   current thread, and unlocks F.  If no other page shares F,
+   returns its memory to the user pool. */
+void
+frame_release (struct frame *f, struct page *p)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+
+  list_remove (&p->frame_elem);
+  p->frame = NULL;
+  if (!list_empty (&f->pages))
+    {
+      lock_release (&f->lock);
+      return;
+    }
+
+  frame_unshare (f);
+  lock_acquire (&scan_lock);
+  if (hand == &f->elem)
+    hand = list_next (hand);
+  list_remove (&f->elem);
+  frame_cnt--;
+  palloc_free_page (f->kpage);
+  f->kpage = NULL;
+  list_push_front (&unused_frames, &f->elem);
+  lock_release (&f->lock);
+  lock_release (&scan_lock);
+}
+
+/* Advances the clock hand to a frame whose pages have not been
+   accessed recently, giving each accessed frame a second chance,
+   and returns it with its lock held.  Frames that are locked
+   are passed over.  Returns a null pointer if two sweeps find
+   no candidate.  scan_lock must be held.
+
+   Clearing accessed bits along the way costs at most one TLB
+   flush for the whole sweep. */
+static struct frame *
+clock_evict_and_lock (void)
+{
+  struct frame *victim = NULL;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&scan_lock));
+
+  pagedir_begin_batch ();
+  for (i = 0; i < 2 * frame_cnt; i++)
+    {
+      struct frame *f;
+
+      if (hand == list_end (&frames))
+        hand = list_begin (&frames);
+      f = list_entry (hand, struct frame, elem);
+      hand = list_next (hand);
+
+      /* Skip frames locked by others, and frames the current
+         thread has pinned for a system call. */
+      if (lock_held_by_current_thread (&f->lock)
+          || !lock_try_acquire (&f->lock))
+        continue;
+      if (!frame_accessed_recently (f))
+        {
+          victim = f;
+          break;
+        }
+      lock_release (&f->lock);
+    }
+  pagedir_end_batch ();
+  return victim;
+}
+
+/* Returns true if any page in frame F, which the current thread
+   must have locked, has been accessed since the last call for
+   F, false otherwise. */
+static bool
+frame_accessed_recently (struct frame *f)
+{
+  struct list_elem *e;
+  bool accessed = false;
+
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    if (page_accessed_recently (list_entry (e, struct page, frame_elem)))
+      accessed = true;
+  return accessed;
+}
+
+/* Evicts every page in frame F, which the current thread must
+   have locked, leaving F empty.  Returns true if successful,
+   false if a page could not be written out. */
+static bool
+frame_evict (struct frame *f)
+{
+  while (!list_empty (&f->pages))
+    {
+      struct page *p = list_entry (list_front (&f->pages),
+                                   struct page, frame_elem);
+      if (!page_out (p))
+        return false;
+    }
+  frame_unshare (f);
+  return true;
+}
+
+/* Removes frame F, which the current thread must have locked,
+   from the share table, if it is there. */
+static void
+frame_unshare (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+
+  if (f->inode != NULL)
+    {
+      lock_acquire (&share_lock);
+      hash_delete (&share_table, &f->share_elem);
+      lock_release (&share_lock);
+      f->inode = NULL;
+    }
+}
+
+/* Returns a hash value for the shared frame containing E. */
+static unsigned
+share_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct frame *f = hash_entry (e, struct frame, share_elem);
+  return hash_bytes (&f->inode, sizeof f->inode) ^ hash_int (f->ofs);
+}
+
+/* Returns true if shared frame A's page precedes B's. */
+static bool
+share_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct frame *a = hash_entry (a_, struct frame, share_elem);
+  const struct frame *b = hash_entry (b_, struct frame, share_elem);
+
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  else if (a->ofs != b->ofs)
+    return a->ofs < b->ofs;
+  else
+    return a->read_bytes < b->read_bytes;
+}
@@ -0,0 +1,53 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <hash.h>
+#include <list.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+
+struct inode;
+struct page;
+
+/* A frame of physical memory holding a user page.
+
+   A frame is pinned while its lock is held: the lock is taken
+   while the frame's page is being loaded, evicted, or accessed
+   by the kernel, and the clock algorithm passes over frames
+   whose lock is held.  A struct frame is never freed, so that a
+   thread waiting on its lock can safely find out that it now
+   holds some other page.
+
+   A frame normally holds a page of a single process.  A frame
+   holding a read-only page of an executable file may instead be
+   shared by every process that maps that page, in which case it
+   is entered in the share table under the file's inode and the
+   page's offset and length, and PAGES lists all of them. */
+struct frame
+  {
+    struct lock lock;           /* Pins the frame. */
+    void *kpage;                /* Kernel virtual address, or null. */
+    struct list pages;          /* Pages occupying the frame. */
+    struct list_elem elem;      /* Element in frame table or unused list. */
+
+    /* Sharing. */
+    struct inode *inode;        /* File inode, or null if not shared. */
+    off_t ofs;                  /* Offset of page in file. */
+    size_t read_bytes;          /* Bytes of page read from file. */
+    struct hash_elem share_elem; /* Element in share table. */
+  };
+
+void frame_init (void);
+struct frame *frame_alloc_and_lock (struct page *);
+struct frame *frame_try_alloc_and_lock (struct page *);
+struct frame *frame_share_lock (struct page *, struct inode *, off_t ofs,
+                                size_t read_bytes);
+bool frame_is_shared (struct inode *, off_t ofs, size_t read_bytes);
+void frame_share (struct frame *, struct inode *, off_t ofs,
+                  size_t read_bytes);
+void frame_lock (struct page *);
+void frame_unlock (struct frame *);
+void frame_release (struct frame *, struct page *);
+
+#endif /* vm/frame.h */
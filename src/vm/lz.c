@@ -0,0 +1,163 @@
+#include "vm/lz.h"
+#include <debug.h>
+#include <string.h>
+
+/* A small LZ77 codec, used to compress pages written to swap.
+
+   The compressed form is a sequence of items, each introduced by
+   a control byte C:
+
+     - C < 0x80: a run of C + 1 literal bytes follows.
+
+     - C >= 0x80: copy (C & 0x7f) + MIN_MATCH bytes starting the
+       number of bytes back given by the next two bytes, least
+       significant first.  The copy may overlap the bytes it
+       produces, which encodes runs of a repeated pattern.
+
+   The compressor finds matches through a hash table of the last
+   position at which each 3-byte sequence occurred, trading some
+   compression for speed: it examines a single candidate per
+   position.  The decompressor produces exactly as many bytes as
+   requested, so the compressed size need not be recorded. */
+
+/* Shortest and longest matches, in bytes. */
+#define MIN_MATCH 3
+#define MAX_MATCH (0x7f + MIN_MATCH)
+
+/* Longest literal run, in bytes. */
+#define MAX_LITERALS 0x80
+
+/* Marks an empty hash table entry. */
+#define NO_POS UINT16_MAX
+
+/* Returns a hash of the MIN_MATCH bytes at P. */
+static inline unsigned
+hash3 (const uint8_t *p)
+{
+  uint32_t x = p[0] | (p[1] << 8) | ((uint32_t) p[2] << 16);
+  return (x * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Appends the CNT literal bytes at LITERALS to DST, which holds
+   *OUT bytes out of DST_SIZE, and advances *OUT.  Returns true
+   if successful, false if DST is too small. */
+static bool
+put_literals (uint8_t *dst, size_t *out, size_t dst_size,
+              const uint8_t *literals, size_t cnt)
+{
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_LITERALS ? cnt : MAX_LITERALS;
+
+      if (*out + 1 + n > dst_size)
+        return false;
+      dst[(*out)++] = n - 1;
+      memcpy (dst + *out, literals, n);
+      *out += n;
+      literals += n;
+      cnt -= n;
+    }
+  return true;
+}
+
+/* Compresses the SRC_SIZE bytes at SRC, which must be fewer than
+   65535, into DST, using W as scratch memory.  Returns the
+   number of bytes written to DST, or 0 if the result would not
+   fit in DST_SIZE bytes. */
+size_t
+lz_compress (const void *src_, size_t src_size,
+             void *dst_, size_t dst_size, struct lz_work *w)
+{
+  const uint8_t *src = src_;
+  uint8_t *dst = dst_;
+  size_t in = 0;
+  size_t out = 0;
+  size_t literal_start = 0;
+
+  ASSERT (src_size < NO_POS);
+
+  memset (w->table, 0xff, sizeof w->table);
+  while (in + MIN_MATCH <= src_size)
+    {
+      unsigned h = hash3 (src + in);
+      size_t cand = w->table[h];
+
+      w->table[h] = in;
+      if (cand != NO_POS && !memcmp (src + cand, src + in, MIN_MATCH))
+        {
+          size_t len = MIN_MATCH;
+          size_t ofs = in - cand;
+
+          while (in + len < src_size && len < MAX_MATCH
+                 && src[cand + len] == src[in + len])
+            len++;
+
+          if (!put_literals (dst, &out, dst_size, src + literal_start,
+                             in - literal_start)
+              || out + 3 > dst_size)
+            return 0;
+          dst[out++] = 0x80 | (len - MIN_MATCH);
+          dst[out++] = ofs & 0xff;
+          dst[out++] = ofs >> 8;
+
+          in += len;
+          literal_start = in;
+        }
+      else
+        in++;
+    }
+
+  if (!put_literals (dst, &out, dst_size, src + literal_start,
+                     src_size - literal_start))
+    return 0;
+  return out;
+}
+
+/* Decompresses the data at SRC, at most SRC_SIZE bytes long,
+   into exactly DST_SIZE bytes at DST.  Returns true if
+   successful, false if SRC is corrupt or too short. */
+bool
+lz_decompress (const void *src_, size_t src_size,
+               void *dst_, size_t dst_size)
+{
+  const uint8_t *src = src_;
+  uint8_t *dst = dst_;
+  size_t in = 0;
+  size_t out = 0;
+
+  while (out < dst_size)
+    {
+      uint8_t c;
+
+      if (in >= src_size)
+        return false;
+      c = src[in++];
+      if (c < 0x80)
+        {
+          size_t n = c + 1;
+
+          if (in + n > src_size || out + n > dst_size)
+            return false;
+          memcpy (dst + out, src + in, n);
+          in += n;
+          out += n;
+        }
+      else
+        {
+          size_t len = (c & 0x7f) + MIN_MATCH;
+          size_t ofs;
+
+          if (in + 2 > src_size)
+            return false;
+          ofs = src[in] | (src[in + 1] << 8);
+          in += 2;
+          if (ofs == 0 || ofs > out || out + len > dst_size)
+            return false;
+
+          /* Byte by byte, since the source may overlap. */
+          for (; len > 0; len--, out++)
+            dst[out] = dst[out - ofs];
+        }
+    }
+  return true;
+}
@@ -0,0 +1,24 @@
+#ifndef VM_LZ_H
+#define VM_LZ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Number of entries in the compressor's hash table. */
+#define LZ_HASH_BITS 10
+#define LZ_HASH_SIZE (1u << LZ_HASH_BITS)
+
+/* Scratch memory for lz_compress().  Too big for a kernel stack,
+   so callers provide it. */
+struct lz_work
+  {
+    uint16_t table[LZ_HASH_SIZE];   /* Last position of each hash. */
+  };
+
+size_t lz_compress (const void *src, size_t src_size,
+                    void *dst, size_t dst_size, struct lz_work *);
+bool lz_decompress (const void *src, size_t src_size,
+                    void *dst, size_t dst_size);
+
+#endif /* vm/lz.h */
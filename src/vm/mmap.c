@@ -0,0 +1,130 @@
+#include "vm/mmap.h"
+#include <debug.h>
+#include <round.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/page.h"
+
+/* Memory-mapped files.
+
+   Mapping a file enters each of its pages in the supplemental
+   page table, backed by the file itself, without reading
+   anything: page_in() reads each page when it is first
+   accessed.  When a page of a mapping is evicted or unmapped, it
+   is written back to the file if and only if its dirty bit is
+   set.  The last page of a mapping is written back only up to
+   the end of the file. */
+
+static struct mapping *mapping_lookup (mapid_t);
+static void mapping_remove (struct mapping *);
+
+/* Maps FILE into the current process's address space starting at
+   ADDR and returns the new mapping's identifier, or MAP_FAILED
+   if FILE is empty, ADDR is not page-aligned, the pages needed
+   would overlap any existing page or fall outside user memory,
+   or memory allocation fails.  The mapping uses its own file
+   handle, so FILE may be closed afterward. */
+mapid_t
+mmap_map (struct file *file, void *addr)
+{
+  struct thread *t = thread_current ();
+  struct mapping *m;
+  off_t length = file_length (file);
+  size_t page_cnt = DIV_ROUND_UP (length, PGSIZE);
+  uint8_t *upage = addr;
+  size_t i;
+
+  if (length == 0 || upage == NULL || pg_ofs (upage) != 0)
+    return MAP_FAILED;
+  for (i = 0; i < page_cnt; i++)
+    if (!is_user_vaddr (upage + i * PGSIZE)
+        || upage + i * PGSIZE < upage
+        || page_lookup (upage + i * PGSIZE) != NULL)
+      return MAP_FAILED;
+
+  m = malloc (sizeof *m);
+  if (m == NULL)
+    return MAP_FAILED;
+  m->file = file_reopen (file);
+  if (m->file == NULL)
+    {
+      free (m);
+      return MAP_FAILED;
+    }
+  m->id = t->next_mapid++;
+  m->base = upage;
+  m->page_cnt = 0;
+  list_push_back (&t->mappings, &m->elem);
+
+  for (i = 0; i < page_cnt; i++)
+    {
+      off_t ofs = i * PGSIZE;
+      size_t read_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+
+      if (page_add_mmap (upage + ofs, m->file, ofs, read_bytes) == NULL)
+        {
+          mapping_remove (m);
+          return MAP_FAILED;
+        }
+      m->page_cnt++;
+    }
+  return m->id;
+}
+
+/* Unmaps the current process's mapping MAPPING, writing its
+   dirty pages back to the file.  Does nothing if there is no
+   such mapping. */
+void
+mmap_unmap (mapid_t mapping)
+{
+  struct mapping *m = mapping_lookup (mapping);
+
+  if (m != NULL)
+    mapping_remove (m);
+}
+
+/* Unmaps all of the current process's mappings. */
+void
+mmap_unmap_all (void)
+{
+  struct list *mappings = &thread_current ()->mappings;
+
+  while (!list_empty (mappings))
+    mapping_remove (list_entry (list_front (mappings),
+                                struct mapping, elem));
+}
+
+/* Returns the current process's mapping with identifier ID, or a
+   null pointer if there is none. */
+static struct mapping *
+mapping_lookup (mapid_t id)
+{
+  struct list *mappings = &thread_current ()->mappings;
+  struct list_elem *e;
+
+  for (e = list_begin (mappings); e != list_end (mappings);
+       e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (m->id == id)
+        return m;
+    }
+  return NULL;
+}
+
+/* Removes mapping M's pages from the current process's address
+   space, writing back those that are dirty, and frees M. */
+static void
+mapping_remove (struct mapping *m)
+{
+  uint8_t *upage = m->base;
+  size_t i;
+
+  for (i = 0; i < m->page_cnt; i++)
+    page_remove (page_lookup (upage + i * PGSIZE));
+  list_remove (&m->elem);
+  file_close (m->file);
+  free (m);
+}
@@ -0,0 +1,598 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/swap.h"
+
+/* Supplemental page table.
+
+   Each process keeps a hash table of struct page, keyed on user
+   virtual address, that says where the contents of each page of
+   its address space come from.  load() enters each page of the
+   executable's segments in the table without reading anything;
+   the first access to a page faults, and page_fault() calls
+   page_in() to obtain a frame, fill it from the executable
+   file or with zeros, and map it into the page directory.
+
+   When the frame table needs to reclaim a frame, page_out()
+   unmaps its page.  A page that has never been modified can
+   simply be loaded again later; one that has been modified is
+   written to swap.  Once modified, a page goes to swap whenever
+   it is evicted, since its initial contents are no longer of
+   any use.
+
+   Read-only pages loaded from a file are shared with every
+   other process that maps the same page of the same file: see
+   frame.c.  load() denies writes to the executable while it
+   runs, so such pages never change.
+
+   A process's stack starts out as a single page and grows on
+   demand, up to stack_page_limit pages: a fault on an address
+   outside every page in the table is taken as stack growth, and
+   a zero page added there, if it is in the stack region and no
+   more than 32 bytes below the stack pointer, the farthest that
+   the PUSHA instruction accesses before it moves the stack
+   pointer.  Anything else is a wild access.
+
+   Pages of memory-mapped files (see mmap.c) are never swapped.
+   Instead, a page that is dirty when it is evicted or removed is
+   written back to its file, and later loaded from there.
+
+   A fault on a page that must be read from its file also loads
+   the pages that follow it in the same file, as long as free
+   frames are at hand, and reads them all with as few disk
+   requests as the file's layout allows.  The number of pages
+   loaded at once starts at FAULT_AROUND_MIN and doubles, up to
+   FAULT_AROUND_MAX, each time a process faults on the page just
+   past the last batch, so that a sequential scan of a file soon
+   faults only once per FAULT_AROUND_MAX pages.  The extra pages
+   are mapped with their accessed bits clear, so the clock
+   reclaims them first if they go unused. */
+
+/* Maximum size of a user stack, in pages.
+   Controlled by kernel command-line option "-sl". */
+size_t stack_page_limit = 2048;
+
+/* The farthest below the stack pointer that a user instruction
+   accesses the stack, which is PUSHA's. */
+#define STACK_SLOP 32
+
+/* Number of pages loaded by a fault on a file page: at least
+   FAULT_AROUND_MIN, doubling on sequential faults up to
+   FAULT_AROUND_MAX. */
+#define FAULT_AROUND_MIN 4
+#define FAULT_AROUND_MAX 16
+
+/* Number of sectors per page. */
+#define PAGE_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Statistics. */
+static long long fault_load_cnt;    /* File pages loaded on fault. */
+static long long read_ahead_cnt;    /* File pages loaded around them. */
+static long long read_request_cnt;  /* Batched file reads. */
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func page_destroy;
+static struct page *page_add (void *upage, bool writable);
+static bool page_load (struct page *);
+static bool page_load_and_lock (struct page *);
+static bool page_load_file (struct page *);
+static bool can_read_ahead (const struct page *prev, const struct page *,
+                            off_t length);
+static bool is_stack_growth (const void *fault_addr, const void *esp);
+static void page_write_back (struct page *);
+
+/* Initializes the current process's supplemental page table.
+   Returns true if successful, false if memory allocation
+   fails. */
+bool
+page_table_init (void)
+{
+  struct thread *t = thread_current ();
+
+  t->readahead_next = NULL;
+  t->readahead_window = FAULT_AROUND_MIN;
+  return hash_init (&t->pages, page_hash, page_less, NULL);
+}
+
+/* Destroys the current process's supplemental page table,
+   releasing its pages' frames and swap slots.  Must be called
+   before the process's page directory is destroyed.  The
+   process must not access user memory again, so its pages are
+   unmapped with a single TLB flush. */
+void
+page_table_destroy (void)
+{
+  pagedir_begin_batch ();
+  hash_destroy (&thread_current ()->pages, page_destroy);
+  pagedir_end_batch ();
+}
+
+/* Adds a page at UPAGE to the current process's supplemental
+   page table, whose first READ_BYTES bytes are read from FILE
+   starting at offset OFS and the rest zeroed.  The page is
+   writable by the user process if WRITABLE is true, read-only
+   otherwise.  Returns the new page, or a null pointer if memory
+   allocation fails or UPAGE is already in the table.
+
+   FILE must remain open until the table is destroyed. */
+struct page *
+page_add_file (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes, bool writable)
+{
+  struct page *p;
+
+  ASSERT (read_bytes <= PGSIZE);
+
+  p = page_add (upage, writable);
+  if (p != NULL)
+    {
+      p->file = file;
+      p->file_ofs = ofs;
+      p->read_bytes = read_bytes;
+    }
+  return p;
+}
+
+/* Adds a page at UPAGE to the current process's supplemental
+   page table that starts out entirely zero.  The page is
+   writable by the user process if WRITABLE is true, read-only
+   otherwise.  Returns the new page, or a null pointer if memory
+   allocation fails or UPAGE is already in the table. */
+struct page *
+page_add_zero (void *upage, bool writable)
+{
+  return page_add (upage, writable);
+}
+
+/* Adds a writable page at UPAGE to the current process's
+   supplemental page table for the memory-mapped file FILE, whose
+   first READ_BYTES bytes are at offset OFS in FILE and the rest
+   zeroed.  Returns the new page, or a null pointer if memory
+   allocation fails or UPAGE is already in the table.
+
+   FILE must remain open until the page is removed. */
+struct page *
+page_add_mmap (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes)
+{
+  struct page *p = page_add_file (upage, file, ofs, read_bytes, true);
+
+  if (p != NULL)
+    p->mapped = true;
+  return p;
+}
+
+/* Removes page P from the current process's supplemental page
+   table and frees it, along with its frame or swap slot.  A
+   dirty memory-mapped page is first written back to its file. */
+void
+page_remove (struct page *p)
+{
+  hash_delete (&thread_current ()->pages, &p->hash_elem);
+  page_destroy (&p->hash_elem, NULL);
+}
+
+/* Returns the page containing user virtual address ADDR in the
+   current process's supplemental page table, or a null pointer
+   if there is none. */
+struct page *
+page_lookup (const void *addr)
+{
+  struct page p;
+  struct hash_elem *e;
+
+  p.upage = pg_round_down (addr);
+  e = hash_find (&thread_current ()->pages, &p.hash_elem);
+  return e != NULL ? hash_entry (e, struct page, hash_elem) : NULL;
+}
+
+/* Loads the page containing FAULT_ADDR, which must not be
+   mapped, into a frame if it is not in one already, and maps it
+   into the current process's page directory.  If FAULT_ADDR is
+   not in the supplemental page table, but appears to be an
+   access to the stack given user stack pointer ESP, adds a new
+   stack page there first; ESP may be null if it is not known.
+   Returns true if successful, false if FAULT_ADDR is not a
+   valid address or the page cannot be loaded. */
+bool
+page_in (void *fault_addr, void *esp)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+
+  if (t->pagedir == NULL || !is_user_vaddr (fault_addr))
+    return false;
+  p = page_lookup (fault_addr);
+  if (p == NULL)
+    {
+      if (!is_stack_growth (fault_addr, esp))
+        return false;
+      p = page_add_zero (pg_round_down (fault_addr), true);
+      if (p == NULL)
+        return false;
+    }
+
+  if (!page_load_and_lock (p))
+    return false;
+  frame_unlock (p->frame);
+  return true;
+}
+
+/* Pins the page containing user address ADDR in memory, loading
+   it and mapping it first if necessary, so that the kernel can
+   access it, even while holding locks, without faulting.  If
+   WILL_WRITE is true, the page must be writable.  Returns true if
+   successful, false if ADDR is not in a page of the current
+   process, or the page is read-only and WILL_WRITE is true, or
+   it cannot be loaded.  Every successful call must be balanced
+   by a call to page_unlock(). */
+bool
+page_lock (const void *addr, bool will_write)
+{
+  struct page *p;
+
+  if (!is_user_vaddr (addr))
+    return false;
+  p = page_lookup (addr);
+  if (p == NULL || (will_write && !p->writable))
+    return false;
+  return page_load_and_lock (p);
+}
+
+/* Unpins the page containing ADDR, which must have been pinned
+   by page_lock(). */
+void
+page_unlock (const void *addr)
+{
+  struct page *p = page_lookup (addr);
+
+  ASSERT (p != NULL && p->frame != NULL);
+  frame_unlock (p->frame);
+}
+
+/* Evicts page P from its frame, which the current thread must
+   have locked, writing it to swap if necessary, and removes P
+   from the frame's list of pages.  Returns true if successful,
+   false if swap space is full, in which case P stays in its
+   frame.  P's owner will fault on its next access to P. */
+bool
+page_out (struct page *p)
+{
+  uint32_t *pd = p->owner->pagedir;
+
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  /* Unmap the page first, so that the owner can no longer modify
+     it and will wait on the frame's lock if it faults. */
+  pagedir_clear_page (pd, p->upage);
+  if (p->mapped)
+    {
+      if (pagedir_is_dirty (pd, p->upage))
+        page_write_back (p);
+    }
+  else
+    {
+      if (pagedir_is_dirty (pd, p->upage))
+        p->dirty = true;
+      if (p->dirty)
+        {
+          p->swap_slot = swap_out (p->frame->kpage);
+          if (p->swap_slot == SWAP_ERROR)
+            return false;
+        }
+    }
+
+  /* The owner reads P->frame without the frame's lock, and may
+     load P into a new frame, relinking P->frame_elem, as soon as
+     it sees a null pointer.  So unlink P first and publish the
+     null pointer last. */
+  list_remove (&p->frame_elem);
+  barrier ();
+  p->frame = NULL;
+  return true;
+}
+
+/* Returns true if page P has been accessed since the last call
+   for P, false otherwise.  P's frame must be locked by the
+   current thread. */
+bool
+page_accessed_recently (struct page *p)
+{
+  uint32_t *pd = p->owner->pagedir;
+  bool accessed;
+
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  accessed = pagedir_is_accessed (pd, p->upage);
+  if (accessed)
+    pagedir_set_accessed (pd, p->upage, false);
+  return accessed;
+}
+
+/* Prints paging statistics. */
+void
+page_print_stats (void)
+{
+  printf ("Paging: %lld pages loaded on fault, %lld read ahead, "
+          "%lld file reads\n",
+          fault_load_cnt, read_ahead_cnt, read_request_cnt);
+}
+
+/* Locks page P's frame, first loading P into a frame if it is
+   not in one and mapping it if it is not mapped.  Returns true
+   if successful, false on failure. */
+static bool
+page_load_and_lock (struct page *p)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+
+  frame_lock (p);
+  if (p->frame == NULL && !page_load (p))
+    return false;
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  if (pagedir_get_page (pd, p->upage) == NULL
+      && !pagedir_set_page (pd, p->upage, p->frame->kpage, p->writable))
+    {
+      frame_unlock (p->frame);
+      return false;
+    }
+  return true;
+}
+
+/* Obtains a frame for page P and fills it from swap, P's file,
+   or with zeros.  Returns true with the frame locked if
+   successful, false on failure. */
+static bool
+page_load (struct page *p)
+{
+  uint8_t *kpage;
+
+  if (p->file != NULL && p->swap_slot == SWAP_ERROR)
+    return page_load_file (p);
+
+  p->frame = frame_alloc_and_lock (p);
+  if (p->frame == NULL)
+    return false;
+  kpage = p->frame->kpage;
+
+  if (p->swap_slot != SWAP_ERROR)
+    {
+      swap_in (p->swap_slot, kpage);
+      p->swap_slot = SWAP_ERROR;
+    }
+  else
+    memset (kpage, 0, PGSIZE);
+  return true;
+}
+
+/* Obtains a frame for page P, which must be loaded from its
+   file, and fills it, along with as many of the pages that
+   follow P in the file as the current thread's fault-around
+   window allows.  The following pages are mapped and unlocked.
+   Returns true with P's frame locked if successful, false on
+   failure. */
+static bool
+page_load_file (struct page *p)
+{
+  struct thread *t = thread_current ();
+  struct inode *inode = file_get_inode (p->file);
+  off_t length = inode_length (inode);
+  struct page *batch[FAULT_AROUND_MAX];
+  void *sectors[FAULT_AROUND_MAX * PAGE_SECTORS];
+  size_t batch_cnt, sector_cnt;
+  size_t i, j;
+
+  ASSERT (p->file_ofs % BLOCK_SECTOR_SIZE == 0);
+
+  /* Map a read-only file page that another process has already
+     loaded, if possible. */
+  if (!p->writable)
+    {
+      p->frame = frame_share_lock (p, inode, p->file_ofs, p->read_bytes);
+      if (p->frame != NULL)
+        return true;
+    }
+  if (p->file_ofs + (off_t) p->read_bytes > length)
+    return false;
+
+  /* Widen the window on a sequential fault, otherwise start
+     over. */
+  if (p->upage != t->readahead_next)
+    t->readahead_window = FAULT_AROUND_MIN;
+  else if (t->readahead_window < FAULT_AROUND_MAX)
+    t->readahead_window *= 2;
+
+  p->frame = frame_alloc_and_lock (p);
+  if (p->frame == NULL)
+    return false;
+  batch[0] = p;
+
+  /* Take a free frame for each following page that can be read
+     along with P, stopping at the first one that cannot or when
+     memory runs short. */
+  for (batch_cnt = 1; batch_cnt < t->readahead_window; batch_cnt++)
+    {
+      struct page *prev = batch[batch_cnt - 1];
+      struct page *q = page_lookup ((uint8_t *) prev->upage + PGSIZE);
+
+      if (q == NULL || !can_read_ahead (prev, q, length))
+        break;
+      q->frame = frame_try_alloc_and_lock (q);
+      if (q->frame == NULL)
+        break;
+      batch[batch_cnt] = q;
+    }
+
+  /* Read all the pages at once. */
+  sector_cnt = 0;
+  for (i = 0; i < batch_cnt; i++)
+    {
+      uint8_t *kpage = batch[i]->frame->kpage;
+      for (j = 0; j < DIV_ROUND_UP (batch[i]->read_bytes, BLOCK_SECTOR_SIZE);
+           j++)
+        sectors[sector_cnt++] = kpage + j * BLOCK_SECTOR_SIZE;
+    }
+  if (!inode_read_sectors (inode, p->file_ofs, sectors, sector_cnt))
+    {
+      for (i = 0; i < batch_cnt; i++)
+        frame_release (batch[i]->frame, batch[i]);
+      return false;
+    }
+  read_request_cnt++;
+  fault_load_cnt++;
+  read_ahead_cnt += batch_cnt - 1;
+  t->readahead_next = (uint8_t *) p->upage + batch_cnt * PGSIZE;
+
+  for (i = 0; i < batch_cnt; i++)
+    {
+      struct page *q = batch[i];
+      uint8_t *kpage = q->frame->kpage;
+
+      memset (kpage + q->read_bytes, 0, PGSIZE - q->read_bytes);
+      if (!q->writable)
+        frame_share (q->frame, inode, q->file_ofs, q->read_bytes);
+      if (i == 0)
+        continue;
+      if (pagedir_set_page (t->pagedir, q->upage, kpage, q->writable))
+        frame_unlock (q->frame);
+      else
+        frame_release (q->frame, q);
+    }
+  return true;
+}
+
+/* Returns true if page Q, which follows PREV in the current
+   process's address space, can be read from the file in the same
+   batch as PREV, given that the file is LENGTH bytes long. */
+static bool
+can_read_ahead (const struct page *prev, const struct page *q,
+                off_t length)
+{
+  if (prev->read_bytes != PGSIZE
+      || q->file != prev->file
+      || q->file_ofs != prev->file_ofs + PGSIZE
+      || q->mapped != prev->mapped
+      || q->frame != NULL
+      || q->swap_slot != SWAP_ERROR
+      || q->file_ofs + (off_t) q->read_bytes > length)
+    return false;
+
+  /* A read-only page that another process has loaded should be
+     shared, not read again. */
+  return (q->writable
+          || !frame_is_shared (file_get_inode (q->file), q->file_ofs,
+                               q->read_bytes));
+}
+
+/* Returns true if a fault at FAULT_ADDR with user stack pointer
+   ESP should grow the stack, false otherwise. */
+static bool
+is_stack_growth (const void *fault_addr, const void *esp)
+{
+  const uint8_t *addr = fault_addr;
+  const uint8_t *stack_bottom = (uint8_t *) PHYS_BASE
+                                - stack_page_limit * PGSIZE;
+
+  return (esp != NULL
+          && addr < (uint8_t *) PHYS_BASE
+          && addr >= stack_bottom
+          && addr + STACK_SLOP >= (const uint8_t *) esp);
+}
+
+/* Adds a page at UPAGE with no backing file to the current
+   process's supplemental page table and returns it, or returns a
+   null pointer if memory allocation fails or UPAGE is already in
+   the table. */
+static struct page *
+page_add (void *upage, bool writable)
+{
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  p = malloc (sizeof *p);
+  if (p == NULL)
+    return NULL;
+  p->upage = upage;
+  p->owner = thread_current ();
+  p->writable = writable;
+  p->frame = NULL;
+  p->dirty = false;
+  p->swap_slot = SWAP_ERROR;
+  p->file = NULL;
+  p->file_ofs = 0;
+  p->read_bytes = 0;
+  p->mapped = false;
+  if (hash_insert (&thread_current ()->pages, &p->hash_elem) != NULL)
+    {
+      free (p);
+      return NULL;
+    }
+  return p;
+}
+
+/* Returns a hash value for the page containing E. */
+static unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (e, struct page, hash_elem);
+  return hash_int ((uintptr_t) p->upage >> PGBITS);
+}
+
+/* Returns true if page A precedes page B. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct page *a = hash_entry (a_, struct page, hash_elem);
+  const struct page *b = hash_entry (b_, struct page, hash_elem);
+  return a->upage < b->upage;
+}
+
+/* Writes memory-mapped page P, whose frame the current thread
+   must have locked, back to its file. */
+static void
+page_write_back (struct page *p)
+{
+  ASSERT (p->mapped);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  file_write_at (p->file, p->frame->kpage, p->read_bytes, p->file_ofs);
+}
+
+/* Frees the page containing E, along with its frame or swap
+   slot, first writing it back to its file if it is a dirty
+   memory-mapped page. */
+static void
+page_destroy (struct hash_elem *e, void *aux UNUSED)
+{
+  struct page *p = hash_entry (e, struct page, hash_elem);
+  uint32_t *pd = p->owner->pagedir;
+
+  frame_lock (p);
+  if (p->frame != NULL)
+    {
+      pagedir_clear_page (pd, p->upage);
+      if (p->mapped && pagedir_is_dirty (pd, p->upage))
+        page_write_back (p);
+      frame_release (p->frame, p);
+    }
+  else if (p->swap_slot != SWAP_ERROR)
+    swap_free (p->swap_slot);
+  free (p);
+}
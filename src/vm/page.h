@@ -0,0 +1,57 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+struct file;
+struct frame;
+struct thread;
+
+/* A page of a user process's virtual address space, as recorded
+   in its supplemental page table.  A page is entered in the
+   table when it is set up and loaded only when it is first
+   accessed.  FRAME, DIRTY, and SWAP_SLOT may only be changed
+   while holding the lock on the page's frame. */
+struct page
+  {
+    void *upage;                /* User virtual address. */
+    struct hash_elem hash_elem; /* Element in thread's `pages'. */
+    struct thread *owner;       /* Owning thread. */
+    bool writable;              /* Writable by the user process? */
+    struct frame *frame;        /* Frame, or null if not in memory. */
+    struct list_elem frame_elem; /* Element in frame's `pages'. */
+    bool dirty;                 /* Ever modified since loaded? */
+    size_t swap_slot;           /* Swap slot, or SWAP_ERROR. */
+
+    /* Initial contents: READ_BYTES bytes read from FILE starting
+       at FILE_OFS, followed by zeros.  FILE is null for a page
+       that starts out entirely zero. */
+    struct file *file;          /* Backing file, or null. */
+    off_t file_ofs;             /* Offset in FILE. */
+    size_t read_bytes;          /* Bytes to read from FILE. */
+    bool mapped;                /* Write back to FILE, not swap? */
+  };
+
+/* Maximum size of a user stack, in pages. */
+extern size_t stack_page_limit;
+
+bool page_table_init (void);
+void page_table_destroy (void);
+struct page *page_add_file (void *upage, struct file *, off_t ofs,
+                            size_t read_bytes, bool writable);
+struct page *page_add_zero (void *upage, bool writable);
+struct page *page_add_mmap (void *upage, struct file *, off_t ofs,
+                            size_t read_bytes);
+void page_remove (struct page *);
+struct page *page_lookup (const void *addr);
+bool page_in (void *fault_addr, void *esp);
+bool page_lock (const void *addr, bool will_write);
+void page_unlock (const void *addr);
+bool page_out (struct page *);
+bool page_accessed_recently (struct page *);
+void page_print_stats (void);
+
+#endif /* vm/page.h */
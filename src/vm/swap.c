@@ -0,0 +1,311 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/lz.h"
+
+/* Swap space.
+
+   Pages are compressed on their way to swap and stored in as
+   few consecutive sectors as they fit in, so that several
+   compressed pages share the space that one page would
+   otherwise take.  A page that does not compress to
+   PAGE_SECTORS - 1 sectors or fewer is stored as is.  A page of all zeros
+   takes no space at all: it is recorded as a zero page and
+   simply cleared again when it is swapped in.  A bitmap records
+   which sectors are in use.
+
+   Pages are not written to the device one by one.  Instead,
+   swap_out() appends them to a cluster: a run of CLUSTER_SECTORS
+   free sectors, reserved in advance, whose contents are staged
+   in memory.  When the next page does not fit, the filled part
+   of the cluster is written with a single request, and the rest
+   returned to the bitmap.  Pages swapped in before then are
+   copied straight out of the cluster.
+
+   The swap slot returned by swap_out() encodes the first sector
+   of a page and the number of sectors it takes: 0 for a zero
+   page, PAGE_SECTORS for an uncompressed page. */
+
+/* Number of sectors per page. */
+#define PAGE_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Sectors per cluster, and pages of memory to stage one. */
+#define CLUSTER_SECTORS 32
+#define CLUSTER_PAGES (CLUSTER_SECTORS / PAGE_SECTORS)
+
+/* Encoding of swap slots. */
+#define SLOT_CNT_BITS 4
+#define SLOT_CNT_MASK ((1u << SLOT_CNT_BITS) - 1)
+#define SLOT(SECTOR, CNT) (((size_t) (SECTOR) << SLOT_CNT_BITS) | (CNT))
+#define SLOT_SECTOR(SLOT) ((SLOT) >> SLOT_CNT_BITS)
+#define SLOT_CNT(SLOT) ((SLOT) & SLOT_CNT_MASK)
+
+/* The swap device, or a null pointer if there is none. */
+static struct block *swap_device;
+
+/* Sectors in use. */
+static struct bitmap *swap_map;
+
+/* The cluster being filled: CLUSTER_CNT sectors starting at
+   CLUSTER_START are reserved in swap_map, of which the first
+   CLUSTER_USED are staged in CLUSTER_BUF.  CLUSTER_CNT is 0 if
+   no cluster is open. */
+static uint8_t *cluster_buf;
+static size_t cluster_start;
+static size_t cluster_cnt;
+static size_t cluster_used;
+
+/* Scratch page for compressing and decompressing. */
+static uint8_t *scratch;
+
+/* Compressor scratch memory. */
+static struct lz_work lz_work;
+
+/* Protects all of the above.  Held across I/O, since the
+   buffers are shared. */
+static struct lock swap_lock;
+
+/* Statistics. */
+static long long out_page_cnt;      /* Pages swapped out. */
+static long long zero_page_cnt;     /* ...of which all zeros. */
+static long long out_byte_cnt;      /* Bytes of swap they took. */
+static long long write_cnt;         /* Cluster writes. */
+static long long in_page_cnt;       /* Pages swapped in. */
+static long long in_byte_cnt;       /* Bytes read from the device. */
+
+static bool is_zero_page (const void *kpage);
+static size_t cluster_append (const void *data, size_t sector_cnt);
+static bool cluster_open (size_t sector_cnt);
+static void cluster_flush (void);
+
+/* Sets up swap space on the swap block device, if there is
+   one. */
+void
+swap_init (void)
+{
+  size_t sector_cnt = 0;
+
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device != NULL)
+    sector_cnt = block_size (swap_device);
+  else
+    printf ("swap: no swap device, swapping disabled\n");
+
+  swap_map = bitmap_create (sector_cnt);
+  if (swap_map == NULL)
+    PANIC ("swap: bitmap creation failed");
+  cluster_buf = palloc_get_multiple (PAL_ASSERT, CLUSTER_PAGES);
+  scratch = palloc_get_page (PAL_ASSERT);
+  lock_init (&swap_lock);
+}
+
+/* Writes the page at KPAGE to swap and returns its swap slot, or
+   returns SWAP_ERROR if swap space is full. */
+size_t
+swap_out (const void *kpage)
+{
+  size_t size, slot;
+
+  if (is_zero_page (kpage))
+    {
+      lock_acquire (&swap_lock);
+      zero_page_cnt++;
+      out_page_cnt++;
+      lock_release (&swap_lock);
+      return SLOT (0, 0);
+    }
+
+  lock_acquire (&swap_lock);
+  size = lz_compress (kpage, PGSIZE, scratch,
+                      (PAGE_SECTORS - 1) * BLOCK_SECTOR_SIZE, &lz_work);
+  if (size != 0)
+    {
+      /* Clear the slack, so that stale data is not written. */
+      size_t sector_cnt = DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
+      memset (scratch + size, 0, sector_cnt * BLOCK_SECTOR_SIZE - size);
+      slot = cluster_append (scratch, sector_cnt);
+    }
+  else
+    slot = cluster_append (kpage, PAGE_SECTORS);
+  if (slot != SWAP_ERROR)
+    {
+      out_page_cnt++;
+      out_byte_cnt += SLOT_CNT (slot) * BLOCK_SECTOR_SIZE;
+    }
+  lock_release (&swap_lock);
+  return slot;
+}
+
+/* Reads the page in swap slot SLOT into KPAGE and frees the
+   slot. */
+void
+swap_in (size_t slot, void *kpage)
+{
+  size_t sector = SLOT_SECTOR (slot);
+  size_t cnt = SLOT_CNT (slot);
+  uint8_t *data;
+
+  lock_acquire (&swap_lock);
+  in_page_cnt++;
+  if (cnt == 0)
+    {
+      lock_release (&swap_lock);
+      memset (kpage, 0, PGSIZE);
+      return;
+    }
+
+  data = cnt == PAGE_SECTORS ? kpage : scratch;
+  if (cluster_cnt != 0 && sector >= cluster_start
+      && sector < cluster_start + cluster_used)
+    memcpy (data, cluster_buf + (sector - cluster_start) * BLOCK_SECTOR_SIZE,
+            cnt * BLOCK_SECTOR_SIZE);
+  else
+    {
+      void *buffers[PAGE_SECTORS];
+      size_t i;
+
+      for (i = 0; i < cnt; i++)
+        buffers[i] = data + i * BLOCK_SECTOR_SIZE;
+      block_read_multiple (swap_device, sector, buffers, cnt);
+      in_byte_cnt += cnt * BLOCK_SECTOR_SIZE;
+    }
+  if (data != kpage
+      && !lz_decompress (data, cnt * BLOCK_SECTOR_SIZE, kpage, PGSIZE))
+    PANIC ("swap: corrupt page in sectors %zu...%zu",
+           sector, sector + cnt - 1);
+  lock_release (&swap_lock);
+
+  swap_free (slot);
+}
+
+/* Frees swap slot SLOT without reading it. */
+void
+swap_free (size_t slot)
+{
+  size_t sector = SLOT_SECTOR (slot);
+  size_t cnt = SLOT_CNT (slot);
+
+  if (cnt == 0)
+    return;
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_all (swap_map, sector, cnt));
+  bitmap_set_multiple (swap_map, sector, cnt, false);
+  lock_release (&swap_lock);
+}
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void)
+{
+  printf ("Swap: %lld pages out (%lld zero) in %lld bytes, "
+          "%lld writes; %lld pages in, %lld bytes read\n",
+          out_page_cnt, zero_page_cnt, out_byte_cnt, write_cnt,
+          in_page_cnt, in_byte_cnt);
+  if (out_byte_cnt > 0)
+    {
+      long long ratio = ((out_page_cnt - zero_page_cnt) * PGSIZE * 100
+                         / out_byte_cnt);
+      printf ("Swap: compression ratio %lld.%02lld:1\n",
+              ratio / 100, ratio % 100);
+    }
+}
+
+/* Returns true if the page at KPAGE is all zeros. */
+static bool
+is_zero_page (const void *kpage)
+{
+  const uint32_t *p = kpage;
+  size_t i;
+
+  for (i = 0; i < PGSIZE / sizeof *p; i++)
+    if (p[i] != 0)
+      return false;
+  return true;
+}
+
+/* Appends the SECTOR_CNT sectors of DATA to the cluster, opening
+   a new one if necessary, and returns the swap slot where they
+   will be stored.  Returns SWAP_ERROR if swap space is full.
+   swap_lock must be held. */
+static size_t
+cluster_append (const void *data, size_t sector_cnt)
+{
+  size_t sector;
+
+  ASSERT (lock_held_by_current_thread (&swap_lock));
+  ASSERT (sector_cnt > 0 && sector_cnt <= PAGE_SECTORS);
+
+  if (cluster_used + sector_cnt > cluster_cnt)
+    {
+      cluster_flush ();
+      if (!cluster_open (sector_cnt))
+        return SWAP_ERROR;
+    }
+
+  sector = cluster_start + cluster_used;
+  memcpy (cluster_buf + cluster_used * BLOCK_SECTOR_SIZE, data,
+          sector_cnt * BLOCK_SECTOR_SIZE);
+  cluster_used += sector_cnt;
+  return SLOT (sector, sector_cnt);
+}
+
+/* Reserves a run of free sectors for a new cluster, preferably
+   CLUSTER_SECTORS of them but at least SECTOR_CNT.  Returns true
+   if successful, false if swap space is full.  swap_lock must be
+   held and no cluster may be open. */
+static bool
+cluster_open (size_t sector_cnt)
+{
+  size_t cnt = CLUSTER_SECTORS;
+
+  ASSERT (cluster_cnt == 0);
+
+  for (;;)
+    {
+      size_t start = bitmap_scan_and_flip (swap_map, 0, cnt, false);
+      if (start != BITMAP_ERROR)
+        {
+          cluster_start = start;
+          cluster_cnt = cnt;
+          cluster_used = 0;
+          return true;
+        }
+      if (cnt == sector_cnt)
+        return false;
+      cnt = cnt / 2 > sector_cnt ? cnt / 2 : sector_cnt;
+    }
+}
+
+/* Writes the filled part of the open cluster, if any, to the
+   swap device with a single request, and returns the part that
+   was never filled to the free sectors.  swap_lock must be
+   held. */
+static void
+cluster_flush (void)
+{
+  void *buffers[CLUSTER_SECTORS];
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&swap_lock));
+
+  if (cluster_cnt == 0)
+    return;
+  if (cluster_used > 0)
+    {
+      for (i = 0; i < cluster_used; i++)
+        buffers[i] = cluster_buf + i * BLOCK_SECTOR_SIZE;
+      block_write_multiple (swap_device, cluster_start, buffers,
+                            cluster_used);
+      write_cnt++;
+    }
+  bitmap_set_multiple (swap_map, cluster_start + cluster_used,
+                       cluster_cnt - cluster_used, false);
+  cluster_cnt = cluster_used = 0;
+}